@@ -0,0 +1,205 @@
+#pragma once
+
+#include "shared.h"
+#include "unique.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Destructors of objects in an Arena are skipped when this holds. It defaults
+// to trivial destructibility; specialise it for types whose destructor only
+// frees memory that lives in the same arena.
+template <typename T>
+struct ArenaSkipsDestructor : std::is_trivially_destructible<T> {};
+
+template <typename T>
+inline constexpr bool kArenaSkipsDestructor = ArenaSkipsDestructor<std::remove_cv_t<T>>::value;
+
+// Bump allocator for objects that all die together, such as the per-request
+// objects of a server. Allocation advances a cursor through a list of chunks;
+// nothing is freed individually. Reset rewinds to the first chunk in O(1) and
+// keeps every chunk for reuse, so a warmed-up arena allocates no more memory.
+// The chunks are freed when the arena is destroyed.
+//
+// The arena does not track what it holds: everything allocated from it must
+// be dead, or at least never touched again, before Reset or destruction.
+class Arena {
+public:
+    static constexpr size_t kDefaultChunkSize = 64 * 1024;
+
+    explicit Arena(size_t chunk_size = kDefaultChunkSize) : chunk_size_(chunk_size) {
+    }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    ~Arena() {
+        while (first_) {
+            Chunk* next = first_->next;
+            ::operator delete(first_);
+            first_ = next;
+        }
+    }
+
+    void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t)) {
+        size_t padding = Padding(cursor_, alignment);
+        size_t room = static_cast<size_t>(limit_ - cursor_);
+        if (!cursor_ || padding > room || size > room - padding) {
+            if (size > SIZE_MAX - alignment) {
+                throw std::bad_alloc();
+            }
+            NextChunk(size + alignment);
+            padding = Padding(cursor_, alignment);
+        }
+        char* result = cursor_ + padding;
+        cursor_ = result + size;
+        return result;
+    }
+
+    void Reset() {
+        if (first_) {
+            Enter(first_);
+        }
+    }
+
+    // Bytes held in chunks, used or not.
+    size_t BytesReserved() const {
+        return bytes_reserved_;
+    }
+
+private:
+    struct alignas(std::max_align_t) Chunk {
+        Chunk* next;
+        size_t size;
+
+        char* Begin() {
+            return reinterpret_cast<char*>(this + 1);
+        }
+    };
+
+    // Bytes to skip from ptr to the next multiple of alignment. Computed on
+    // the address so that no pointer past the chunk is ever formed.
+    static size_t Padding(const char* ptr, size_t alignment) {
+        auto address = reinterpret_cast<uintptr_t>(ptr);
+        return (alignment - address % alignment) % alignment;
+    }
+
+    // Moves to the next chunk that has room for size bytes. A chunk that is
+    // too small is passed over, not dropped; a new one is linked in after the
+    // current chunk when none of the rest is big enough.
+    void NextChunk(size_t size) {
+        Chunk* chunk = current_ ? current_->next : first_;
+        while (chunk && chunk->size < size) {
+            chunk = chunk->next;
+        }
+        if (!chunk) {
+            size_t chunk_size = size > chunk_size_ ? size : chunk_size_;
+            chunk = static_cast<Chunk*>(::operator new(sizeof(Chunk) + chunk_size));
+            chunk->size = chunk_size;
+            bytes_reserved_ += chunk_size;
+            if (current_) {
+                chunk->next = current_->next;
+                current_->next = chunk;
+            } else {
+                chunk->next = first_;
+                first_ = chunk;
+            }
+        }
+        Enter(chunk);
+    }
+
+    void Enter(Chunk* chunk) {
+        current_ = chunk;
+        cursor_ = chunk->Begin();
+        limit_ = cursor_ + chunk->size;
+    }
+
+private:
+    size_t chunk_size_;
+    size_t bytes_reserved_ = 0;
+    Chunk* first_ = nullptr;
+    Chunk* current_ = nullptr;
+    char* cursor_ = nullptr;
+    char* limit_ = nullptr;
+};
+
+// Stateless deleter for UniquePtr to an arena object: runs the destructor
+// and leaves the memory to the arena.
+template <typename T>
+struct ArenaDeleter {
+    ArenaDeleter() {
+    }
+
+    template <typename U>
+    ArenaDeleter(const ArenaDeleter<U>&) {
+    }
+
+    void operator()(T* ptr) const {
+        if constexpr (!kArenaSkipsDestructor<T>) {
+            ptr->~T();
+        }
+    }
+};
+
+template <typename T>
+using ArenaUniquePtr = UniquePtr<T, ArenaDeleter<T>>;
+
+// Allocator over an Arena whose deallocate does nothing, for AllocateShared.
+template <typename T>
+class ArenaAllocator {
+public:
+    using value_type = T;
+
+    explicit ArenaAllocator(Arena& arena) : arena_(&arena) {
+    }
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena_(other.arena_) {
+    }
+
+    T* allocate(size_t count) {
+        return static_cast<T*>(arena_->Allocate(count * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T*, size_t) {
+    }
+
+    template <typename U>
+    void destroy(U* ptr) {
+        if constexpr (!kArenaSkipsDestructor<U>) {
+            ptr->~U();
+        }
+    }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const {
+        return arena_ == other.arena_;
+    }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const {
+        return arena_ != other.arena_;
+    }
+
+private:
+    template <typename U>
+    friend class ArenaAllocator;
+
+    Arena* arena_;
+};
+
+template <typename T, typename... Args>
+ArenaUniquePtr<T> MakeUniqueIn(Arena& arena, Args&&... args) {
+    void* memory = arena.Allocate(sizeof(T), alignof(T));
+    return ArenaUniquePtr<T>(::new (memory) T(std::forward<Args>(args)...));
+}
+
+// The control block and the object share one arena allocation. When the
+// strong count reaches zero the object is destroyed as usual; the memory is
+// reclaimed by the arena's Reset whatever the counts are.
+template <typename T, typename Policy = SingleThreadedPolicy, typename... Args>
+SharedPtr<T, Policy> MakeSharedIn(Arena& arena, Args&&... args) {
+    return AllocateShared<T, Policy>(ArenaAllocator<T>(arena), std::forward<Args>(args)...);
+}
@@ -0,0 +1,197 @@
+#pragma once
+
+#include "shared.h"
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free atomic holder for SharedPtr<T, AtomicPolicy> using split reference
+// counts. The current value lives in a heap node; word_ packs the node address
+// (low 48 bits, enough for x86-64 user space) with an external count of readers
+// that are still copying out of it (high 16 bits). A reader bumps the external
+// count with a single fetch_add, copies the SharedPtr and then drops its claim
+// on the node's internal count. Whoever unlinks the node moves the external
+// count over to the internal one; the node is freed when that reaches zero.
+template <typename T>
+class AtomicSharedPtr {
+public:
+    using Value = SharedPtr<T, AtomicPolicy>;
+
+public:
+    AtomicSharedPtr() {
+    }
+
+    AtomicSharedPtr(Value desired) : word_(Pack(MakeNode(std::move(desired)), 0)) {
+    }
+
+    AtomicSharedPtr(const AtomicSharedPtr& other) = delete;
+    AtomicSharedPtr& operator=(const AtomicSharedPtr& other) = delete;
+
+    ~AtomicSharedPtr() {
+        Unlink(word_.load(std::memory_order_acquire));
+    }
+
+    Value Load() const {
+        uintptr_t word = Acquire();
+        Node* node = NodeOf(word);
+        if (!node) {
+            return Value();
+        }
+        Value result = node->value;
+        Release(node);
+        return result;
+    }
+
+    void Store(Value desired) {
+        Unlink(word_.exchange(Pack(MakeNode(std::move(desired)), 0), std::memory_order_acq_rel));
+    }
+
+    Value Exchange(Value desired) {
+        uintptr_t old = word_.exchange(Pack(MakeNode(std::move(desired)), 0), std::memory_order_acq_rel);
+        Node* node = NodeOf(old);
+        if (!node) {
+            return Value();
+        }
+        // Other readers may still be copying out of the node, so the value
+        // can only be copied, not moved.
+        Value result = node->value;
+        Unlink(old);
+        return result;
+    }
+
+    // On failure expected receives the current value.
+    bool CompareExchange(Value& expected, Value desired) {
+        Node* desired_node = MakeNode(std::move(desired));
+        while (true) {
+            uintptr_t word = Acquire();
+            Node* node = NodeOf(word);
+
+            if (!Equals(node, expected)) {
+                expected = node ? node->value : Value();
+                if (node) {
+                    Release(node);
+                }
+                delete desired_node;
+                return false;
+            }
+
+            // Our claim keeps node alive, so a matching address is the same node
+            // and only the external count may have moved.
+            uintptr_t current = word + kOneReader;
+            do {
+                if (word_.compare_exchange_weak(current, Pack(desired_node, 0), std::memory_order_acq_rel,
+                                                std::memory_order_acquire)) {
+                    // The external count we unlinked includes our own claim.
+                    Unlink(current);
+                    if (node) {
+                        Release(node);
+                    }
+                    return true;
+                }
+            } while (NodeOf(current) == node);
+
+            if (node) {
+                Release(node);
+            }
+        }
+    }
+
+    bool IsLockFree() const {
+        return word_.is_lock_free();
+    }
+
+private:
+    struct Node {
+        explicit Node(Value v) : value(std::move(v)) {
+        }
+
+        Value value;
+        std::atomic<int64_t> internal_count{kLinkBias};
+    };
+
+    static_assert(sizeof(uintptr_t) == 8, "AtomicSharedPtr packs a 48-bit address and a 16-bit count");
+    static_assert(std::atomic<uintptr_t>::is_always_lock_free);
+
+    // While linked the node carries this bias, so readers that finish before
+    // their external claims are transferred can never drive it to zero.
+    static constexpr int64_t kLinkBias = int64_t(1) << 40;
+    static constexpr int kCountShift = 48;
+    static constexpr uintptr_t kOneReader = uintptr_t(1) << kCountShift;
+    static constexpr uintptr_t kPointerMask = kOneReader - 1;
+    // Past this many outstanding claims a reader folds them into the node.
+    static constexpr uintptr_t kTransferThreshold = uintptr_t(1) << 14;
+
+private:
+    static uintptr_t Pack(Node* node, uintptr_t count) {
+        return reinterpret_cast<uintptr_t>(node) | (count << kCountShift);
+    }
+
+    static Node* NodeOf(uintptr_t word) {
+        return reinterpret_cast<Node*>(word & kPointerMask);
+    }
+
+    static uintptr_t CountOf(uintptr_t word) {
+        return word >> kCountShift;
+    }
+
+    static Node* MakeNode(Value value) {
+        if (!value && value.Get() == nullptr) {
+            return nullptr;
+        }
+        return new Node(std::move(value));
+    }
+
+    static bool Equals(Node* node, const Value& expected) {
+        if (!node) {
+            return !expected && expected.Get() == nullptr;
+        }
+        return node->value == expected;
+    }
+
+    // Registers a reader on the current node; returns the word as it was
+    // before the increment.
+    uintptr_t Acquire() const {
+        uintptr_t word = word_.fetch_add(kOneReader, std::memory_order_acquire);
+        if (CountOf(word) + 1 >= kTransferThreshold) {
+            Transfer(word + kOneReader);
+        }
+        return word;
+    }
+
+    // Credits the node first and only then clears the external count, so the
+    // node is never under-counted; a failed CAS undoes the credit.
+    void Transfer(uintptr_t word) const {
+        Node* node = NodeOf(word);
+        int64_t count = static_cast<int64_t>(CountOf(word));
+        if (node) {
+            node->internal_count.fetch_add(count, std::memory_order_relaxed);
+        }
+        if (!word_.compare_exchange_strong(word, Pack(node, 0), std::memory_order_acq_rel,
+                                           std::memory_order_relaxed) &&
+            node) {
+            if (node->internal_count.fetch_sub(count, std::memory_order_acq_rel) == count) {
+                delete node;
+            }
+        }
+    }
+
+    static void Release(Node* node) {
+        if (node->internal_count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete node;
+        }
+    }
+
+    static void Unlink(uintptr_t word) {
+        Node* node = NodeOf(word);
+        if (!node) {
+            return;
+        }
+        int64_t delta = static_cast<int64_t>(CountOf(word)) - kLinkBias;
+        if (node->internal_count.fetch_add(delta, std::memory_order_acq_rel) + delta == 0) {
+            delete node;
+        }
+    }
+
+private:
+    mutable std::atomic<uintptr_t> word_{0};
+};
@@ -0,0 +1,1012 @@
+// Micro-benchmarks for the pointers in this tree against their std
+// counterparts. There is no build target; compile it directly, e.g.
+//
+//     g++ -std=c++17 -O2 -pthread benchmark.cpp -o benchmark
+//
+// Options:
+//     --format=json|csv      output format (default json)
+//     --threads=1,2,4        thread counts for the threaded cases
+//     --iterations=N         operations per thread per case
+//     --filter=SUBSTRING     run only the cases whose name contains it
+//
+// Each timed result is the mean wall time per operation of one thread, with
+// all threads started together. Multi-threaded runs use AtomicPolicy;
+// SingleThreadedPolicy is only measured at one thread.
+
+#include "arena.h"
+#include "atomic_shared.h"
+#include "inline_unique.h"
+#include "observer_list.h"
+#include "relocate.h"
+#include "shared.h"
+#include "unique.h"
+#include "weak.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string format = "json";
+    std::vector<size_t> threads = {1, 2, 4, 8, 16, 32, 64};
+    size_t iterations = 200000;
+    std::string filter;
+};
+
+struct Result {
+    std::string name;
+    std::string impl;
+    size_t threads;
+    double value;
+    std::string unit;
+};
+
+using Report = std::vector<Result>;
+
+struct Payload {
+    int64_t values[4] = {};
+};
+
+template <typename T>
+void Escape(T&& value) {
+#if defined(__GNUC__)
+    asm volatile("" : : "g"(&value) : "memory");
+#else
+    static volatile const void* sink;
+    sink = &value;
+#endif
+}
+
+// Runs state.Run(iterations) on threads threads released together and returns
+// the mean time per operation per thread in nanoseconds.
+template <typename State>
+double RunThreads(State& state, size_t threads, size_t iterations) {
+    std::atomic<size_t> ready{0};
+    std::atomic<bool> go{false};
+    std::vector<double> elapsed(threads);
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < threads; ++i) {
+        workers.emplace_back([&, i] {
+            ready.fetch_add(1);
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            auto start = Clock::now();
+            state.Run(iterations);
+            elapsed[i] = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        });
+    }
+    while (ready.load() != threads) {
+        std::this_thread::yield();
+    }
+    go.store(true, std::memory_order_release);
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    double total = 0;
+    for (double ns : elapsed) {
+        total += ns;
+    }
+    return total / static_cast<double>(threads * iterations);
+}
+
+// Implementations share one interface so every case is written once.
+
+template <typename Policy>
+struct OwnImpl {
+    template <typename T>
+    using Shared = SharedPtr<T, Policy>;
+    template <typename T>
+    using Weak = WeakPtr<T, Policy>;
+
+    static const char* Name() {
+        return std::is_same_v<Policy, AtomicPolicy> ? "SharedPtr<Atomic>" : "SharedPtr<Single>";
+    }
+
+    template <typename T, typename... Args>
+    static Shared<T> Make(Args&&... args) {
+        return MakeShared<T, Policy>(std::forward<Args>(args)...);
+    }
+
+    template <typename T>
+    static Shared<T> Lock(const Weak<T>& weak) {
+        return weak.Lock();
+    }
+
+    template <typename T>
+    static void Reset(Shared<T>& ptr, T* value) {
+        ptr.Reset(value);
+    }
+};
+
+struct StdImpl {
+    template <typename T>
+    using Shared = std::shared_ptr<T>;
+    template <typename T>
+    using Weak = std::weak_ptr<T>;
+
+    static const char* Name() {
+        return "std";
+    }
+
+    template <typename T, typename... Args>
+    static Shared<T> Make(Args&&... args) {
+        return std::make_shared<T>(std::forward<Args>(args)...);
+    }
+
+    template <typename T>
+    static Shared<T> Lock(const Weak<T>& weak) {
+        return weak.lock();
+    }
+
+    template <typename T>
+    static void Reset(Shared<T>& ptr, T* value) {
+        ptr.reset(value);
+    }
+};
+
+// The control block as it was before the vtable was dropped: virtual
+// Destroy/Deallocate and 64-bit counts, with the object stored inline. Just
+// enough of a SharedPtr to run the make and copy cases against the
+// manager-function block, with the same single-threaded counting.
+class VirtualBlock {
+public:
+    virtual ~VirtualBlock() = default;
+
+    void IncRefStrong() {
+        ++strong_;
+    }
+
+    void DecRefStrong() {
+        if (--strong_ == 0) {
+            Destroy();
+            if (--total_ == 0) {
+                Deallocate();
+            }
+        }
+    }
+
+protected:
+    virtual void Destroy() = 0;
+    virtual void Deallocate() = 0;
+
+private:
+    uint64_t strong_ = 1;
+    uint64_t total_ = 1;
+};
+
+template <typename T>
+class VirtualDirectBlock : public VirtualBlock {
+public:
+    template <typename... Args>
+    explicit VirtualDirectBlock(Args&&... args) {
+        ::new (&storage_) T(std::forward<Args>(args)...);
+    }
+
+    T* Get() {
+        return std::launder(reinterpret_cast<T*>(&storage_));
+    }
+
+private:
+    void Destroy() override {
+        Get()->~T();
+    }
+
+    void Deallocate() override {
+        delete this;
+    }
+
+    std::aligned_storage_t<sizeof(T), alignof(T)> storage_;
+};
+
+template <typename T>
+class VirtualShared {
+public:
+    VirtualShared(VirtualBlock* block, T* ptr) : block_(block), ptr_(ptr) {
+    }
+
+    VirtualShared(const VirtualShared& other) : block_(other.block_), ptr_(other.ptr_) {
+        block_->IncRefStrong();
+    }
+
+    VirtualShared& operator=(const VirtualShared&) = delete;
+
+    ~VirtualShared() {
+        block_->DecRefStrong();
+    }
+
+private:
+    VirtualBlock* block_;
+    T* ptr_;
+};
+
+struct VirtualImpl {
+    template <typename T>
+    using Shared = VirtualShared<T>;
+
+    static const char* Name() {
+        return "vtable block (before)";
+    }
+
+    template <typename T, typename... Args>
+    static Shared<T> Make(Args&&... args) {
+        auto block = new VirtualDirectBlock<T>(std::forward<Args>(args)...);
+        return Shared<T>(block, block->Get());
+    }
+};
+
+// Cases. Each is a state type constructed once per run, whose Run() is called
+// on every thread; shared fields are what the threads contend on.
+
+template <typename Impl>
+struct MakeSharedCase {
+    void Run(size_t iterations) {
+        for (size_t i = 0; i < iterations; ++i) {
+            auto ptr = Impl::template Make<Payload>();
+            Escape(ptr);
+        }
+    }
+};
+
+template <typename Impl>
+struct NewSharedCase {
+    void Run(size_t iterations) {
+        for (size_t i = 0; i < iterations; ++i) {
+            typename Impl::template Shared<Payload> ptr(new Payload());
+            Escape(ptr);
+        }
+    }
+};
+
+template <typename Impl>
+struct CopyCase {
+    typename Impl::template Shared<Payload> source = Impl::template Make<Payload>();
+
+    void Run(size_t iterations) {
+        for (size_t i = 0; i < iterations; ++i) {
+            auto copy = source;
+            Escape(copy);
+        }
+    }
+};
+
+// One operation is a move out and a move back.
+template <typename Impl>
+struct MoveCase {
+    void Run(size_t iterations) {
+        auto ptr = Impl::template Make<Payload>();
+        for (size_t i = 0; i < iterations; ++i) {
+            auto moved = std::move(ptr);
+            Escape(moved);
+            ptr = std::move(moved);
+        }
+    }
+};
+
+template <typename Impl>
+struct WeakLockCase {
+    typename Impl::template Shared<Payload> source = Impl::template Make<Payload>();
+    typename Impl::template Weak<Payload> weak = source;
+
+    void Run(size_t iterations) {
+        for (size_t i = 0; i < iterations; ++i) {
+            auto locked = Impl::Lock(weak);
+            Escape(locked);
+        }
+    }
+};
+
+template <typename Impl>
+struct ResetCase {
+    void Run(size_t iterations) {
+        typename Impl::template Shared<Payload> ptr;
+        for (size_t i = 0; i < iterations; ++i) {
+            Impl::Reset(ptr, new Payload());
+            Escape(ptr);
+        }
+    }
+};
+
+struct StatefulDeleter {
+    int64_t tag = 1;
+
+    void operator()(Payload* ptr) const {
+        delete ptr;
+    }
+};
+
+template <typename Ptr, typename Deleter>
+struct UniqueMoveCase {
+    void Run(size_t iterations) {
+        Ptr ptr(new Payload(), Deleter());
+        for (size_t i = 0; i < iterations; ++i) {
+            Ptr moved = std::move(ptr);
+            Escape(moved);
+            ptr = std::move(moved);
+        }
+    }
+};
+
+template <typename Make>
+struct UniqueMakeCase {
+    void Run(size_t iterations) {
+        for (size_t i = 0; i < iterations; ++i) {
+            auto ptr = Make()();
+            Escape(ptr);
+        }
+    }
+};
+
+struct MakeUniqueNew {
+    UniquePtr<Payload> operator()() const {
+        return UniquePtr<Payload>(new Payload());
+    }
+};
+
+struct MakeUniquePooled {
+    PooledUniquePtr<Payload> operator()() const {
+        return MakeUnique<Payload>();
+    }
+};
+
+struct MakeUniqueStd {
+    std::unique_ptr<Payload> operator()() const {
+        return std::make_unique<Payload>();
+    }
+};
+
+struct AtomicSharedLoadCase {
+    AtomicSharedPtr<Payload> source{MakeShared<Payload, AtomicPolicy>()};
+
+    void Run(size_t iterations) {
+        for (size_t i = 0; i < iterations; ++i) {
+            auto ptr = source.Load();
+            Escape(ptr);
+        }
+    }
+};
+
+struct MutexSharedLoadCase {
+    std::mutex mutex;
+    SharedPtr<Payload, AtomicPolicy> source = MakeShared<Payload, AtomicPolicy>();
+
+    void Run(size_t iterations) {
+        for (size_t i = 0; i < iterations; ++i) {
+            SharedPtr<Payload, AtomicPolicy> ptr;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ptr = source;
+            }
+            Escape(ptr);
+        }
+    }
+};
+
+struct StdAtomicSharedLoadCase {
+    std::shared_ptr<Payload> source = std::make_shared<Payload>();
+
+    void Run(size_t iterations) {
+        for (size_t i = 0; i < iterations; ++i) {
+            auto ptr = std::atomic_load(&source);
+            Escape(ptr);
+        }
+    }
+};
+
+// Publishing to 10k weakly held subscribers. One operation is one publish,
+// i.e. one pass over every subscriber.
+
+constexpr size_t kSubscribers = 10000;
+
+struct Listener {
+    int64_t id;
+
+    explicit Listener(int64_t value) : id(value) {
+    }
+};
+
+struct Subscribers {
+    std::vector<SharedPtr<Listener, AtomicPolicy>> listeners;
+
+    Subscribers() {
+        for (size_t i = 0; i < kSubscribers; ++i) {
+            listeners.push_back(MakeShared<Listener, AtomicPolicy>(static_cast<int64_t>(i)));
+        }
+    }
+};
+
+struct ObserverListPublishCase : Subscribers {
+    WeakObserverList<Listener> list;
+
+    ObserverListPublishCase() {
+        for (const auto& listener : listeners) {
+            list.Subscribe(listener);
+        }
+    }
+
+    void Run(size_t iterations) {
+        int64_t sum = 0;
+        for (size_t i = 0; i < iterations; ++i) {
+            list.ForEach([&sum](Listener& listener) { sum += listener.id; });
+        }
+        Escape(sum);
+    }
+};
+
+// The baseline: a mutex-guarded vector, locked for the whole publish.
+struct MutexVectorPublishCase : Subscribers {
+    std::mutex mutex;
+    std::vector<WeakPtr<Listener, AtomicPolicy>> list;
+
+    MutexVectorPublishCase() {
+        for (const auto& listener : listeners) {
+            list.emplace_back(listener);
+        }
+    }
+
+    void Run(size_t iterations) {
+        int64_t sum = 0;
+        for (size_t i = 0; i < iterations; ++i) {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto it = list.begin(); it != list.end();) {
+                if (auto listener = it->Lock()) {
+                    sum += listener->id;
+                    ++it;
+                } else {
+                    it = list.erase(it);
+                }
+            }
+        }
+        Escape(sum);
+    }
+};
+
+// Runner.
+
+class Runner {
+public:
+    explicit Runner(const Options& options) : options_(options) {
+    }
+
+    bool Enabled(const char* name) const {
+        return options_.filter.empty() || std::strstr(name, options_.filter.c_str());
+    }
+
+    template <typename State>
+    void Time(const char* name, const char* impl, size_t threads) {
+        Time<State>(name, impl, threads, options_.iterations);
+    }
+
+    template <typename State>
+    void Time(const char* name, const char* impl, size_t threads, size_t iterations) {
+        State state;
+        double ns = RunThreads(state, threads, iterations);
+        report_.push_back({name, impl, threads, ns, "ns/op"});
+    }
+
+    // A case whose threads only touch their own pointers.
+    template <template <typename> class Case>
+    void TimeShared(const char* name) {
+        if (!Enabled(name)) {
+            return;
+        }
+        for (size_t threads : options_.threads) {
+            if (threads == 1) {
+                Time<Case<OwnImpl<SingleThreadedPolicy>>>(name, OwnImpl<SingleThreadedPolicy>::Name(), 1);
+            }
+            Time<Case<OwnImpl<AtomicPolicy>>>(name, OwnImpl<AtomicPolicy>::Name(), threads);
+            Time<Case<StdImpl>>(name, StdImpl::Name(), threads);
+        }
+    }
+
+    void Record(const char* name, const char* impl, size_t threads, double value, const char* unit) {
+        if (!Enabled(name)) {
+            return;
+        }
+        report_.push_back({name, impl, threads, value, unit});
+    }
+
+    const Options& GetOptions() const {
+        return options_;
+    }
+
+    const Report& GetReport() const {
+        return report_;
+    }
+
+private:
+    const Options& options_;
+    Report report_;
+};
+
+// Make-and-destroy and copy-and-destroy with a virtual control block, for
+// comparison with SharedPtr<Single> under the same names.
+void RunVtableCases(Runner& runner) {
+    if (runner.Enabled("make_shared")) {
+        runner.Time<MakeSharedCase<VirtualImpl>>("make_shared", VirtualImpl::Name(), 1);
+    }
+    if (runner.Enabled("copy")) {
+        runner.Time<CopyCase<VirtualImpl>>("copy", VirtualImpl::Name(), 1);
+    }
+}
+
+void RunUniqueCases(Runner& runner) {
+    const char* stateless = "unique_move_stateless";
+    const char* stateful = "unique_move_stateful";
+    const char* make = "make_unique";
+    for (size_t threads : runner.GetOptions().threads) {
+        if (runner.Enabled(stateless)) {
+            runner.Time<UniqueMoveCase<UniquePtr<Payload>, Slug<Payload>>>(stateless, "UniquePtr", threads);
+            runner.Time<UniqueMoveCase<std::unique_ptr<Payload>, std::default_delete<Payload>>>(stateless, "std", threads);
+        }
+        if (runner.Enabled(stateful)) {
+            runner.Time<UniqueMoveCase<UniquePtr<Payload, StatefulDeleter>, StatefulDeleter>>(stateful, "UniquePtr", threads);
+            runner.Time<UniqueMoveCase<std::unique_ptr<Payload, StatefulDeleter>, StatefulDeleter>>(stateful, "std", threads);
+        }
+        if (runner.Enabled(make)) {
+            runner.Time<UniqueMakeCase<MakeUniquePooled>>(make, "MakeUnique", threads);
+            runner.Time<UniqueMakeCase<MakeUniqueNew>>(make, "UniquePtr(new)", threads);
+            runner.Time<UniqueMakeCase<MakeUniqueStd>>(make, "std::make_unique", threads);
+        }
+    }
+}
+
+void RunPublishCases(Runner& runner) {
+    const char* name = "observer_publish";
+    if (!runner.Enabled(name)) {
+        return;
+    }
+    size_t publishes = std::max<size_t>(1, runner.GetOptions().iterations / kSubscribers);
+    for (size_t threads : runner.GetOptions().threads) {
+        runner.Time<ObserverListPublishCase>(name, "WeakObserverList", threads, publishes);
+        runner.Time<MutexVectorPublishCase>(name, "mutex+vector<WeakPtr>", threads, publishes);
+    }
+}
+
+void RunAtomicSharedCases(Runner& runner) {
+    const char* name = "atomic_shared_load";
+    if (!runner.Enabled(name)) {
+        return;
+    }
+    for (size_t threads : runner.GetOptions().threads) {
+        runner.Time<AtomicSharedLoadCase>(name, "AtomicSharedPtr", threads);
+        runner.Time<MutexSharedLoadCase>(name, "mutex+SharedPtr", threads);
+        runner.Time<StdAtomicSharedLoadCase>(name, "std::atomic_load", threads);
+    }
+}
+
+// Resident memory held by objects that only weak references keep around.
+
+size_t ResidentBytes() {
+#if defined(__linux__)
+    FILE* file = std::fopen("/proc/self/statm", "r");
+    if (!file) {
+        return 0;
+    }
+    unsigned long size = 0;
+    unsigned long resident = 0;
+    int read = std::fscanf(file, "%lu %lu", &size, &resident);
+    std::fclose(file);
+    return read == 2 ? resident * static_cast<size_t>(sysconf(_SC_PAGESIZE)) : 0;
+#else
+    return 0;
+#endif
+}
+
+struct LargePayload {
+    char bytes[256 * 1024];
+
+    LargePayload() {
+        std::memset(bytes, 1, sizeof(bytes));
+    }
+};
+
+template <typename Make, typename Weak>
+double RetainedBytes(Make make, std::vector<Weak>& weaks) {
+    constexpr size_t kObjects = 256;
+    size_t before = ResidentBytes();
+    for (size_t i = 0; i < kObjects; ++i) {
+        weaks.emplace_back(make());
+    }
+    size_t after = ResidentBytes();
+    weaks.clear();
+    return after > before ? static_cast<double>(after - before) : 0;
+}
+
+void RunWeakMemoryCases(Runner& runner) {
+    const char* name = "weak_retained_rss";
+    if (!runner.Enabled(name)) {
+        return;
+    }
+    std::vector<WeakPtr<LargePayload>> own;
+    std::vector<std::weak_ptr<LargePayload>> std_weaks;
+    runner.Record(name, "MakeShared", 1, RetainedBytes([] { return MakeShared<LargePayload>(); }, own), "bytes");
+    runner.Record(name, "MakeSharedSplit", 1, RetainedBytes([] { return MakeSharedSplit<LargePayload>(); }, own),
+                  "bytes");
+    runner.Record(name, "std::make_shared", 1,
+                  RetainedBytes([] { return std::make_shared<LargePayload>(); }, std_weaks), "bytes");
+}
+
+// Teardown of long chains and large trees. The iterative nodes opt in to
+// Teardown; std::unique_ptr uses the usual hand-written unlinking loop, and
+// std::shared_ptr is only measured on trees, whose depth it can survive.
+
+constexpr size_t kChainLength = 3000000;
+constexpr size_t kTreeDepth = 21;
+
+struct SharedListNode : IterativeTeardownBase {
+    SharedPtr<SharedListNode> next;
+};
+
+struct UniqueListNode : IterativeTeardownBase {
+    UniquePtr<UniqueListNode> next;
+};
+
+struct StdListNode {
+    std::unique_ptr<StdListNode> next;
+
+    ~StdListNode() {
+        while (next) {
+            next = std::move(next->next);
+        }
+    }
+};
+
+template <typename Ptr, typename Make>
+Ptr BuildList(Make make) {
+    Ptr head;
+    for (size_t i = 0; i < kChainLength; ++i) {
+        Ptr node = make();
+        node->next = std::move(head);
+        head = std::move(node);
+    }
+    return head;
+}
+
+struct SharedTreeNode : IterativeTeardownBase {
+    SharedPtr<SharedTreeNode> left;
+    SharedPtr<SharedTreeNode> right;
+};
+
+struct StdTreeNode {
+    std::shared_ptr<StdTreeNode> left;
+    std::shared_ptr<StdTreeNode> right;
+};
+
+template <typename Ptr, typename Make>
+Ptr BuildTree(size_t depth, Make make) {
+    if (depth == 0) {
+        return Ptr();
+    }
+    Ptr node = make();
+    node->left = BuildTree<Ptr>(depth - 1, make);
+    node->right = BuildTree<Ptr>(depth - 1, make);
+    return node;
+}
+
+template <typename Ptr>
+double TeardownNs(Ptr ptr, size_t nodes) {
+    auto start = Clock::now();
+    ptr = Ptr();
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / static_cast<double>(nodes);
+}
+
+void RunTeardownCases(Runner& runner) {
+    const char* list = "teardown_list";
+    if (runner.Enabled(list)) {
+        auto shared = BuildList<SharedPtr<SharedListNode>>([] {
+            return MakeShared<SharedListNode>();
+        });
+        runner.Record(list, "SharedPtr<Single>", 1, TeardownNs(std::move(shared), kChainLength), "ns/op");
+        auto unique = BuildList<UniquePtr<UniqueListNode>>([] {
+            return UniquePtr<UniqueListNode>(new UniqueListNode());
+        });
+        runner.Record(list, "UniquePtr", 1, TeardownNs(std::move(unique), kChainLength), "ns/op");
+        auto std_unique = BuildList<std::unique_ptr<StdListNode>>([] {
+            return std::make_unique<StdListNode>();
+        });
+        runner.Record(list, "std::unique_ptr+loop", 1, TeardownNs(std::move(std_unique), kChainLength), "ns/op");
+    }
+
+    const char* tree = "teardown_tree";
+    if (runner.Enabled(tree)) {
+        size_t nodes = (size_t(1) << kTreeDepth) - 1;
+        auto shared = BuildTree<SharedPtr<SharedTreeNode>>(kTreeDepth, [] { return MakeShared<SharedTreeNode>(); });
+        runner.Record(tree, "SharedPtr<Single>", 1, TeardownNs(std::move(shared), nodes), "ns/op");
+        auto std_shared = BuildTree<std::shared_ptr<StdTreeNode>>(kTreeDepth, [] {
+            return std::make_shared<StdTreeNode>();
+        });
+        runner.Record(tree, "std", 1, TeardownNs(std::move(std_shared), nodes), "ns/op");
+    }
+}
+
+// Growing and sorting a large array of handles. Each handle is a copy of one
+// of a small set of objects, picked pseudo-randomly.
+
+constexpr size_t kHandleCount = 10000000;
+constexpr size_t kHandleSources = 1024;
+
+template <typename T>
+void Append(std::vector<T>& handles, const T& value) {
+    handles.push_back(value);
+}
+
+template <typename T>
+void Append(RelocatingVector<T>& handles, const T& value) {
+    handles.PushBack(value);
+}
+
+template <typename T>
+const void* Address(const SharedPtr<T>& ptr) {
+    return ptr.Get();
+}
+
+template <typename T>
+const void* Address(const std::shared_ptr<T>& ptr) {
+    return ptr.get();
+}
+
+template <typename Vector, typename Ptr>
+void TimeHandles(Runner& runner, const char* impl, const std::vector<Ptr>& sources) {
+    Vector handles;
+    auto start = Clock::now();
+    uint64_t state = 1;
+    for (size_t i = 0; i < kHandleCount; ++i) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        Append(handles, sources[(state >> 33) % sources.size()]);
+    }
+    double fill_ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    runner.Record("vector_growth", impl, 1, fill_ns / kHandleCount, "ns/op");
+
+    start = Clock::now();
+    std::sort(handles.begin(), handles.end(),
+              [](const Ptr& left, const Ptr& right) { return Address(left) < Address(right); });
+    double sort_ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    runner.Record("handle_sort", impl, 1, sort_ns / kHandleCount, "ns/op");
+}
+
+void RunHandleCases(Runner& runner) {
+    if (!runner.Enabled("vector_growth") && !runner.Enabled("handle_sort")) {
+        return;
+    }
+    std::vector<SharedPtr<Payload>> sources;
+    std::vector<std::shared_ptr<Payload>> std_sources;
+    for (size_t i = 0; i < kHandleSources; ++i) {
+        sources.push_back(MakeShared<Payload>());
+        std_sources.push_back(std::make_shared<Payload>());
+    }
+    TimeHandles<std::vector<SharedPtr<Payload>>>(runner, "std::vector<SharedPtr>", sources);
+    TimeHandles<RelocatingVector<SharedPtr<Payload>>>(runner, "RelocatingVector<SharedPtr>", sources);
+    TimeHandles<std::vector<std::shared_ptr<Payload>>>(runner, "std::vector<std::shared_ptr>", std_sources);
+}
+
+// Dispatch over an array of small polymorphic objects, each built once and
+// then called in order. InlineUniquePtr keeps them inside the array; UniquePtr
+// points at one allocation per object.
+
+constexpr size_t kStrategyCount = 1000000;
+
+struct Strategy {
+    virtual ~Strategy() = default;
+    virtual uint64_t Apply(uint64_t value) const = 0;
+};
+
+struct AddStrategy : Strategy {
+    uint64_t delta;
+
+    explicit AddStrategy(uint64_t delta) : delta(delta) {
+    }
+    uint64_t Apply(uint64_t value) const override {
+        return value + delta;
+    }
+};
+
+struct MixStrategy : Strategy {
+    uint64_t multiplier;
+
+    explicit MixStrategy(uint64_t multiplier) : multiplier(multiplier | 1) {
+    }
+    uint64_t Apply(uint64_t value) const override {
+        return (value ^ (value >> 29)) * multiplier;
+    }
+};
+
+template <typename Ptr, typename Make>
+void TimeStrategies(Runner& runner, const char* impl, Make make) {
+    std::vector<Ptr> strategies;
+    strategies.reserve(kStrategyCount);
+    for (size_t i = 0; i < kStrategyCount; ++i) {
+        strategies.push_back(make(i));
+    }
+    auto start = Clock::now();
+    uint64_t value = 0;
+    for (const Ptr& strategy : strategies) {
+        value = strategy->Apply(value);
+    }
+    Escape(value);
+    double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    runner.Record("strategy_dispatch", impl, 1, ns / kStrategyCount, "ns/op");
+}
+
+void RunStrategyCases(Runner& runner) {
+    if (!runner.Enabled("strategy_dispatch")) {
+        return;
+    }
+    TimeStrategies<InlineUniquePtr<Strategy, 16>>(runner, "InlineUniquePtr", [](size_t i) {
+        return i % 2 ? MakeInlineUnique<Strategy, AddStrategy, 16>(i) : MakeInlineUnique<Strategy, MixStrategy, 16>(i);
+    });
+    TimeStrategies<UniquePtr<Strategy>>(runner, "UniquePtr", [](size_t i) {
+        return i % 2 ? UniquePtr<Strategy>(new AddStrategy(i)) : UniquePtr<Strategy>(new MixStrategy(i));
+    });
+}
+
+// Per-request objects: a batch of short-lived objects created, held until
+// the end of the request and then all released. The arena pays a destructor
+// call per object and one Reset per request; the heap path frees each object.
+// A first untimed request warms up the arena and the allocator. The large
+// cases use 64 KiB objects whose constructor writes a single field, so any
+// per-byte work in a factory shows up.
+
+constexpr size_t kRequestObjects = 1000000;
+constexpr size_t kLargeRequestObjects = 1000;
+constexpr size_t kRequestRounds = 4;
+
+struct SparsePayload {
+    SparsePayload() {
+        values[0] = 1;
+    }
+
+    int64_t values[8192];
+};
+
+template <typename Ptr, typename Make, typename End>
+void TimeRequests(Runner& runner, const char* name, const char* impl, size_t count, Make make, End end) {
+    std::vector<Ptr> objects;
+    objects.reserve(count);
+    auto request = [&] {
+        for (size_t i = 0; i < count; ++i) {
+            objects.push_back(make());
+        }
+        objects.clear();
+        end();
+    };
+    request();
+    auto start = Clock::now();
+    for (size_t round = 0; round < kRequestRounds; ++round) {
+        request();
+    }
+    double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    runner.Record(name, impl, 1, ns / (count * kRequestRounds), "ns/op");
+}
+
+// Each case gets its own arena, so that chunks sized for one case are not
+// passed over by the next.
+template <typename T>
+void TimeArenaRequests(Runner& runner, const char* unique, const char* shared, size_t count) {
+    auto nothing = [] {};
+
+    if (runner.Enabled(unique)) {
+        Arena arena;
+        TimeRequests<ArenaUniquePtr<T>>(runner, unique, "MakeUniqueIn", count, [&arena] {
+            return MakeUniqueIn<T>(arena);
+        }, [&arena] { arena.Reset(); });
+        TimeRequests<UniquePtr<T>>(runner, unique, "UniquePtr(new)", count, [] {
+            return UniquePtr<T>(new T());
+        }, nothing);
+    }
+
+    if (runner.Enabled(shared)) {
+        Arena arena;
+        TimeRequests<SharedPtr<T>>(runner, shared, "MakeSharedIn", count, [&arena] {
+            return MakeSharedIn<T>(arena);
+        }, [&arena] { arena.Reset(); });
+        TimeRequests<SharedPtr<T>>(runner, shared, "MakeShared", count, [] { return MakeShared<T>(); }, nothing);
+    }
+}
+
+void RunArenaCases(Runner& runner) {
+    TimeArenaRequests<Payload>(runner, "arena_unique", "arena_shared", kRequestObjects);
+    TimeArenaRequests<SparsePayload>(runner, "arena_unique_large", "arena_shared_large", kLargeRequestObjects);
+}
+
+// Output.
+
+void PrintJson(const Report& report) {
+    std::printf("[\n");
+    for (size_t i = 0; i < report.size(); ++i) {
+        const Result& result = report[i];
+        std::printf("  {\"name\": \"%s\", \"impl\": \"%s\", \"threads\": %zu, \"value\": %.3f, \"unit\": \"%s\"}%s\n",
+                    result.name.c_str(), result.impl.c_str(), result.threads, result.value, result.unit.c_str(),
+                    i + 1 < report.size() ? "," : "");
+    }
+    std::printf("]\n");
+}
+
+void PrintCsv(const Report& report) {
+    std::printf("name,impl,threads,value,unit\n");
+    for (const Result& result : report) {
+        std::printf("%s,%s,%zu,%.3f,%s\n", result.name.c_str(), result.impl.c_str(), result.threads, result.value,
+                    result.unit.c_str());
+    }
+}
+
+std::vector<size_t> ParseList(const char* text) {
+    std::vector<size_t> values;
+    char* end = nullptr;
+    for (size_t value = std::strtoul(text, &end, 10); end != text; value = std::strtoul(text, &end, 10)) {
+        values.push_back(value);
+        text = *end == ',' ? end + 1 : end;
+    }
+    return values;
+}
+
+bool ParseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (std::strncmp(arg, "--format=", 9) == 0) {
+            options.format = arg + 9;
+        } else if (std::strncmp(arg, "--threads=", 10) == 0) {
+            options.threads = ParseList(arg + 10);
+        } else if (std::strncmp(arg, "--iterations=", 13) == 0) {
+            options.iterations = std::strtoul(arg + 13, nullptr, 10);
+        } else if (std::strncmp(arg, "--filter=", 9) == 0) {
+            options.filter = arg + 9;
+        } else {
+            return false;
+        }
+    }
+    return (options.format == "json" || options.format == "csv") && options.iterations > 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!ParseOptions(argc, argv, options)) {
+        std::fprintf(stderr,
+                     "usage: %s [--format=json|csv] [--threads=1,2,4] [--iterations=N] [--filter=SUBSTRING]\n",
+                     argv[0]);
+        return 1;
+    }
+
+    Runner runner(options);
+    runner.TimeShared<MakeSharedCase>("make_shared");
+    runner.TimeShared<NewSharedCase>("new_shared");
+    runner.TimeShared<CopyCase>("copy");
+    runner.TimeShared<MoveCase>("move");
+    runner.TimeShared<WeakLockCase>("weak_lock");
+    runner.TimeShared<ResetCase>("reset");
+    RunVtableCases(runner);
+    RunUniqueCases(runner);
+    RunAtomicSharedCases(runner);
+    RunPublishCases(runner);
+    RunWeakMemoryCases(runner);
+    RunTeardownCases(runner);
+    RunHandleCases(runner);
+    RunStrategyCases(runner);
+    RunArenaCases(runner);
+
+    if (options.format == "json") {
+        PrintJson(runner.GetReport());
+    } else {
+        PrintCsv(runner.GetReport());
+    }
+    return 0;
+}
@@ -0,0 +1,274 @@
+#pragma once
+
+#include "shared.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Biased reference counting. The thread that creates a block owns it and
+// counts with plain loads and stores on biased_; every other thread uses an
+// atomic RMW on shared_. Only the sum of the two is meaningful, so the block
+// can be released only after the owner merges them. The owner merges when its
+// own count drops to zero. If another thread's decrement would drive shared_
+// negative, the block is queued for the owner instead, and the owner merges it
+// at its next safe point: MakeSharedBiased, BiasedPolicy::MergePending or
+// thread exit. Queued blocks of an owner that already exited are merged in place.
+//
+// Until that merge a WeakPtr may still lock an object whose last strong
+// reference was dropped off the owner thread; the object is never destroyed
+// while it can be reached.
+//
+// A block created during thread exit, after the thread's record is gone, has
+// no owner and counts atomically from the start.
+class BiasedPolicy {
+public:
+    static constexpr bool kDeferredRelease = true;
+
+    class StrongCounter {
+    public:
+        explicit StrongCounter(size_t value = 0);
+
+        void Bind(IControlBlock<BiasedPolicy>* block) {
+            block_ = block;
+        }
+
+        void Increment();
+        bool Decrement();
+        bool IncrementIfNonZero();
+        size_t Load() const;
+
+    private:
+        friend class BiasedPolicy;
+
+        bool IsOwner() const;
+        bool DecrementShared();
+        bool Merge();
+
+    private:
+        // shared_ keeps its count above two flag bits.
+        static constexpr int64_t kMerged = 1;
+        static constexpr int64_t kQueued = 2;
+        static constexpr int kShift = 2;
+        static constexpr int64_t kOne = int64_t(1) << kShift;
+
+        uint64_t owner_;
+        // Only the owner writes these until the owner merges or exits.
+        bool owner_merged_ = false;
+        std::atomic<int64_t> biased_;
+        std::atomic<int64_t> shared_{0};
+        IControlBlock<BiasedPolicy>* block_ = nullptr;
+    };
+
+    using WeakCounter = AtomicPolicy::Counter;
+
+    // Merges the blocks other threads queued for the calling thread and
+    // releases those whose count turned out to be zero.
+    static void MergePending();
+
+private:
+    struct ThreadRecord {
+        ThreadRecord();
+        ~ThreadRecord();
+
+        // Guarded by the registry mutex. has_pending mirrors !pending.empty()
+        // so that the owner can skip the mutex when nothing was queued.
+        std::vector<StrongCounter*> pending;
+        std::atomic<bool> has_pending{false};
+    };
+
+    struct Registry {
+        std::mutex mutex;
+        std::unordered_map<uint64_t, ThreadRecord*> records;
+        uint64_t next_id = 1;
+    };
+
+    static Registry& GetRegistry() {
+        static Registry registry;
+        return registry;
+    }
+
+    // Zero for threads that never created a biased block or already exited.
+    static uint64_t& CurrentId() {
+        thread_local uint64_t id = 0;
+        return id;
+    }
+
+    // Null whenever CurrentId() is zero.
+    static ThreadRecord*& CurrentRecord() {
+        thread_local ThreadRecord* record = nullptr;
+        return record;
+    }
+
+    static uint64_t RegisterThread() {
+        thread_local ThreadRecord record;
+        return CurrentId();
+    }
+
+    static void MergeAll(std::vector<StrongCounter*>& counters);
+};
+
+inline BiasedPolicy::ThreadRecord::ThreadRecord() {
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    CurrentId() = registry.next_id++;
+    CurrentRecord() = this;
+    registry.records[CurrentId()] = this;
+}
+
+inline BiasedPolicy::ThreadRecord::~ThreadRecord() {
+    std::vector<StrongCounter*> counters;
+    {
+        Registry& registry = GetRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.records.erase(CurrentId());
+        counters.swap(pending);
+    }
+    CurrentId() = 0;
+    CurrentRecord() = nullptr;
+    MergeAll(counters);
+}
+
+inline void BiasedPolicy::MergePending() {
+    ThreadRecord* record = CurrentRecord();
+    if (!record || !record->has_pending.load(std::memory_order_acquire)) {
+        return;
+    }
+    std::vector<StrongCounter*> counters;
+    {
+        std::lock_guard<std::mutex> lock(GetRegistry().mutex);
+        counters.swap(record->pending);
+        record->has_pending.store(false, std::memory_order_relaxed);
+    }
+    MergeAll(counters);
+}
+
+inline void BiasedPolicy::MergeAll(std::vector<StrongCounter*>& counters) {
+    for (StrongCounter* counter : counters) {
+        counter->owner_merged_ = true;
+        if (counter->Merge()) {
+            counter->block_->ReleaseStrong();
+        }
+    }
+}
+
+inline BiasedPolicy::StrongCounter::StrongCounter(size_t value)
+    : owner_(RegisterThread()), biased_(static_cast<int64_t>(value)) {
+    if (owner_ == 0) {
+        // The thread has exited; start out merged.
+        owner_merged_ = true;
+        biased_.store(0, std::memory_order_relaxed);
+        shared_.store((static_cast<int64_t>(value) << kShift) | kMerged, std::memory_order_relaxed);
+    }
+}
+
+inline bool BiasedPolicy::StrongCounter::IsOwner() const {
+    return owner_ != 0 && owner_ == CurrentId() && !owner_merged_;
+}
+
+inline void BiasedPolicy::StrongCounter::Increment() {
+    if (IsOwner()) {
+        biased_.store(biased_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    } else {
+        shared_.fetch_add(kOne, std::memory_order_relaxed);
+    }
+}
+
+inline bool BiasedPolicy::StrongCounter::Decrement() {
+    if (!IsOwner()) {
+        return DecrementShared();
+    }
+
+    int64_t biased = biased_.load(std::memory_order_relaxed) - 1;
+    biased_.store(biased, std::memory_order_relaxed);
+    if (biased != 0) {
+        return false;
+    }
+
+    // The owner dropped out. A queued block is left to MergePending, which
+    // still has a pointer to it.
+    int64_t shared = shared_.load(std::memory_order_relaxed);
+    do {
+        if (shared & kQueued) {
+            return false;
+        }
+    } while (!shared_.compare_exchange_weak(shared, shared | kMerged, std::memory_order_acq_rel,
+                                            std::memory_order_relaxed));
+    owner_merged_ = true;
+    return (shared >> kShift) == 0;
+}
+
+inline bool BiasedPolicy::StrongCounter::DecrementShared() {
+    int64_t shared = shared_.load(std::memory_order_relaxed);
+    int64_t updated;
+    do {
+        updated = shared - kOne;
+        if (!(shared & kMerged) && (updated >> kShift) < 0) {
+            updated |= kQueued;
+        }
+    } while (!shared_.compare_exchange_weak(shared, updated, std::memory_order_acq_rel,
+                                            std::memory_order_relaxed));
+
+    if (updated & kMerged) {
+        return (updated >> kShift) == 0;
+    }
+    if (!(updated & kQueued) || (shared & kQueued)) {
+        return false;
+    }
+
+    {
+        Registry& registry = GetRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        auto it = registry.records.find(owner_);
+        if (it != registry.records.end()) {
+            it->second->pending.push_back(this);
+            it->second->has_pending.store(true, std::memory_order_release);
+            return false;
+        }
+    }
+    // The owner has exited, so biased_ no longer changes.
+    return Merge();
+}
+
+inline bool BiasedPolicy::StrongCounter::Merge() {
+    int64_t delta = (biased_.load(std::memory_order_relaxed) << kShift) | kMerged;
+    int64_t merged = shared_.fetch_add(delta, std::memory_order_acq_rel) + delta;
+    return (merged >> kShift) == 0;
+}
+
+inline bool BiasedPolicy::StrongCounter::IncrementIfNonZero() {
+    if (IsOwner()) {
+        int64_t biased = biased_.load(std::memory_order_relaxed);
+        if (biased + (shared_.load(std::memory_order_acquire) >> kShift) <= 0) {
+            return false;
+        }
+        biased_.store(biased + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    int64_t shared = shared_.load(std::memory_order_relaxed);
+    do {
+        if ((shared & kMerged) && (shared >> kShift) == 0) {
+            return false;
+        }
+    } while (!shared_.compare_exchange_weak(shared, shared + kOne, std::memory_order_acquire,
+                                            std::memory_order_relaxed));
+    return true;
+}
+
+inline size_t BiasedPolicy::StrongCounter::Load() const {
+    int64_t shared = shared_.load(std::memory_order_relaxed);
+    int64_t count = shared >> kShift;
+    if (!(shared & kMerged)) {
+        count += biased_.load(std::memory_order_relaxed);
+    }
+    return count > 0 ? static_cast<size_t>(count) : 0;
+}
+
+template <typename T, typename... Args>
+SharedPtr<T, BiasedPolicy> MakeSharedBiased(Args&&... args) {
+    BiasedPolicy::MergePending();
+    return MakeShared<T, BiasedPolicy>(std::forward<Args>(args)...);
+}
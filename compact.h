@@ -0,0 +1,136 @@
+#pragma once
+
+#include "shared.h"
+
+#include <cstddef>  // std::nullptr_t
+#include <exception>
+
+class BadCompactPtr : public std::exception {};
+
+// One-word SharedPtr for objects created by MakeShared. It keeps only the
+// ControlBlockDirect; the object sits at a fixed offset inside it, so Get()
+// is an add rather than a second stored pointer. Converts to SharedPtr freely
+// and back whenever the SharedPtr owns a ControlBlockDirect<T> and is not an
+// alias; moves in either direction leave the counts untouched.
+template <typename T, typename Policy>
+class CompactSharedPtr {
+public:
+    template <typename U, typename P>
+    friend class CompactSharedPtr;
+
+    using Block = ControlBlockDirect<T, Policy>;
+    using TriviallyRelocatable = std::true_type;
+
+    static_assert(!std::is_array_v<T>, "CompactSharedPtr holds single objects");
+
+public:
+    CompactSharedPtr() noexcept {
+    }
+
+    CompactSharedPtr(std::nullptr_t) noexcept {
+    }
+
+    // Throws BadCompactPtr if other cannot be held compactly.
+    explicit CompactSharedPtr(SharedPtr<T, Policy> other) {
+        if (!CanHold(other)) {
+            throw BadCompactPtr();
+        }
+        block_ = static_cast<Block*>(other.control_block_);
+        other.control_block_ = nullptr;
+        other.ptr_ = nullptr;
+    }
+
+    CompactSharedPtr(const CompactSharedPtr& other) : block_(other.block_) {
+        if (block_) {
+            block_->IncRefStrong();
+        }
+    }
+
+    CompactSharedPtr(CompactSharedPtr&& other) noexcept : block_(other.block_) {
+        other.block_ = nullptr;
+    }
+
+    CompactSharedPtr& operator=(const CompactSharedPtr& other) {
+        CompactSharedPtr(other).Swap(*this);
+        return *this;
+    }
+
+    CompactSharedPtr& operator=(CompactSharedPtr&& other) noexcept {
+        CompactSharedPtr(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ~CompactSharedPtr() {
+        if (block_) {
+            block_->DecRefStrong();
+        }
+    }
+
+    static bool CanHold(const SharedPtr<T, Policy>& ptr) {
+        if (!ptr.control_block_) {
+            return !ptr.ptr_;
+        }
+        return ptr.control_block_->template Is<Block>() &&
+               static_cast<Block*>(ptr.control_block_)->GetRef() == ptr.ptr_;
+    }
+
+    SharedPtr<T, Policy> ToShared() const& {
+        return block_ ? SharedPtr<T, Policy>(static_cast<IControlBlock<Policy>*>(block_), block_->GetRef())
+                      : SharedPtr<T, Policy>();
+    }
+
+    SharedPtr<T, Policy> ToShared() && {
+        SharedPtr<T, Policy> result;
+        result.control_block_ = block_;
+        result.ptr_ = Get();
+        block_ = nullptr;
+        return result;
+    }
+
+    operator SharedPtr<T, Policy>() const& {
+        return ToShared();
+    }
+
+    operator SharedPtr<T, Policy>() && {
+        return std::move(*this).ToShared();
+    }
+
+    void Reset() {
+        CompactSharedPtr().Swap(*this);
+    }
+
+    void Swap(CompactSharedPtr& other) noexcept {
+        std::swap(block_, other.block_);
+    }
+
+    T* Get() const {
+        return block_ ? block_->GetRef() : nullptr;
+    }
+
+    T& operator*() const {
+        return *Get();
+    }
+    T* operator->() const {
+        return Get();
+    }
+    size_t UseCount() const {
+        return block_ ? block_->RefCount() : 0;
+    }
+    explicit operator bool() const {
+        return block_;
+    }
+
+    bool operator==(const CompactSharedPtr& right) const {
+        return block_ == right.block_;
+    }
+
+private:
+    Block* block_ = nullptr;
+};
+
+static_assert(sizeof(CompactSharedPtr<int>) == sizeof(void*));
+
+template <typename T, typename Policy = SingleThreadedPolicy, typename... Args>
+CompactSharedPtr<T, Policy> MakeCompactShared(Args&&... args) {
+    return CompactSharedPtr<T, Policy>(MakeShared<T, Policy>(std::forward<Args>(args)...));
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+#include "shared.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+// Deferred destruction. When the last SharedPtr to an object made by
+// MakeSharedDeferred goes, its block is pushed onto a global lock-free queue
+// instead of running the destructor inline. DrainDeferred(), or a
+// DeferredReclaimer running in the background, destroys everything queued in
+// one batch. Until then the object is unreachable: WeakPtrs already see it as
+// expired.
+//
+// Draining usually happens on another thread, so MakeSharedDeferred counts
+// atomically by default. SingleThreadedPolicy is only safe if every drain
+// runs on the thread that uses the pointers.
+
+struct DeferredNode {
+    DeferredNode* next = nullptr;
+    void (*reclaim)(DeferredNode*) = nullptr;
+};
+
+class DeferredQueue {
+public:
+    struct Stats {
+        size_t batches = 0;
+        size_t objects = 0;
+        size_t max_batch = 0;
+        uint64_t total_ns = 0;
+        uint64_t max_ns = 0;
+        uint64_t last_ns = 0;
+    };
+
+    static void Push(DeferredNode* node) {
+        DeferredNode* head = head_.load(std::memory_order_relaxed);
+        do {
+            node->next = head;
+        } while (!head_.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    // Destroys everything queued so far and returns how many objects that was.
+    // Destructors that queue more objects leave them for the next drain.
+    static size_t Drain() {
+        DeferredNode* node = head_.exchange(nullptr, std::memory_order_acquire);
+        if (!node) {
+            return 0;
+        }
+        auto start = std::chrono::steady_clock::now();
+        size_t count = 0;
+        while (node) {
+            DeferredNode* next = node->next;
+            node->reclaim(node);
+            node = next;
+            ++count;
+        }
+        auto ns = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+
+        std::lock_guard<std::mutex> lock(GetStatsMutex());
+        Stats& stats = GetStatsRef();
+        ++stats.batches;
+        stats.objects += count;
+        stats.max_batch = std::max(stats.max_batch, count);
+        stats.total_ns += ns;
+        stats.max_ns = std::max(stats.max_ns, ns);
+        stats.last_ns = ns;
+        return count;
+    }
+
+    static Stats GetStats() {
+        std::lock_guard<std::mutex> lock(GetStatsMutex());
+        return GetStatsRef();
+    }
+
+private:
+    static std::mutex& GetStatsMutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static Stats& GetStatsRef() {
+        static Stats stats;
+        return stats;
+    }
+
+    static inline std::atomic<DeferredNode*> head_{nullptr};
+};
+
+// Direct block whose destruction is handed to DeferredQueue. It holds an
+// extra weak reference while queued so the block outlives the wait.
+template <typename T, typename Policy = SingleThreadedPolicy>
+class ControlBlockDeferred : public IControlBlock<Policy>, private DeferredNode {
+public:
+    friend IControlBlock<Policy>;
+
+    template <typename... Args>
+    ControlBlockDeferred(Args&&... args)
+        : IControlBlock<Policy>(&IControlBlock<Policy>::template Manage<ControlBlockDeferred>) {
+        ::new (&data_) T(std::forward<Args>(args)...);
+        reclaim = &Reclaim;
+        OwnershipStats::BlockCreated(BlockKind::kDeferred, sizeof(ControlBlockDeferred));
+    }
+
+    T* GetRef() {
+        return reinterpret_cast<T*>(&data_);
+    }
+
+private:
+    void Destroy() {
+        this->IncRefWeak();
+        DeferredQueue::Push(this);
+    }
+
+    static void Reclaim(DeferredNode* node) {
+        auto self = static_cast<ControlBlockDeferred*>(node);
+        if constexpr (std::is_convertible_v<T*, ESFTBase*>) {
+            self->GetRef()->ptr_.ForceDestruct();
+        }
+        std::destroy_at(std::launder(self->GetRef()));
+        self->DecRefWeak();
+    }
+
+    void Deallocate() {
+        OwnershipStats::BlockFreed(sizeof(ControlBlockDeferred));
+        delete this;
+    }
+
+private:
+    std::aligned_storage_t<sizeof(T), alignof(T)> data_;
+};
+
+template <typename T, typename Policy = AtomicPolicy, typename... Args>
+SharedPtr<T, Policy> MakeSharedDeferred(Args&&... args) {
+    auto block = new ControlBlockDeferred<T, Policy>(std::forward<Args>(args)...);
+    return SharedPtr<T, Policy>(static_cast<IControlBlock<Policy>*>(block), block->GetRef());
+}
+
+inline size_t DrainDeferred() {
+    return DeferredQueue::Drain();
+}
+
+inline DeferredQueue::Stats GetDeferredStats() {
+    return DeferredQueue::GetStats();
+}
+
+// Drains the queue every period on a background thread until destroyed; the
+// destructor drains once more on the way out.
+class DeferredReclaimer {
+public:
+    explicit DeferredReclaimer(std::chrono::milliseconds period)
+        : period_(period), thread_([this] { Run(); }) {
+    }
+
+    DeferredReclaimer(const DeferredReclaimer&) = delete;
+    DeferredReclaimer& operator=(const DeferredReclaimer&) = delete;
+
+    ~DeferredReclaimer() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopped_ = true;
+        }
+        wake_.notify_one();
+        thread_.join();
+        DeferredQueue::Drain();
+    }
+
+private:
+    void Run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!wake_.wait_for(lock, period_, [this] { return stopped_; })) {
+            lock.unlock();
+            DeferredQueue::Drain();
+            lock.lock();
+        }
+    }
+
+private:
+    std::chrono::milliseconds period_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopped_ = false;
+    std::thread thread_;
+};
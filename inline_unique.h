@@ -0,0 +1,217 @@
+#pragma once
+
+#include "compressed_pair.h"
+#include "unique.h"  // Slug
+
+#include <cstddef>  // std::nullptr_t, std::max_align_t
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Owning pointer to a Base that keeps the object in an N-byte buffer inside
+// itself when the derived type fits and moves without throwing, and on the
+// heap otherwise. Inline objects cost no allocation and sit next to their
+// owner, so a vector of these is one contiguous run of objects. Heap objects
+// are adopted as with UniquePtr and freed through Deleter, which shares a
+// compressed_pair with the pointer. Emplace and Release allocate with new, so
+// they need the default Deleter, and Base needs a virtual destructor unless D
+// is Base.
+template <typename Base, size_t N = 32, size_t Align = alignof(std::max_align_t), typename Deleter = Slug<Base>>
+class InlineUniquePtr {
+public:
+    template <typename D>
+    static constexpr bool kFitsInline = sizeof(D) <= N && alignof(D) <= Align && std::is_nothrow_move_constructible_v<D>;
+
+public:
+    InlineUniquePtr() noexcept : value_(nullptr, Deleter()) {
+    }
+
+    InlineUniquePtr(std::nullptr_t) noexcept : value_(nullptr, Deleter()) {
+    }
+
+    // Adopts a heap object.
+    explicit InlineUniquePtr(Base* ptr) noexcept : value_(ptr, Deleter()) {
+    }
+
+    InlineUniquePtr(Base* ptr, Deleter deleter) noexcept : value_(ptr, std::move(deleter)) {
+    }
+
+    InlineUniquePtr(const InlineUniquePtr& other) = delete;
+    InlineUniquePtr& operator=(const InlineUniquePtr& other) = delete;
+
+    InlineUniquePtr(InlineUniquePtr&& other) noexcept : value_(nullptr, std::move(other.GetDeleter())) {
+        TakeFrom(other);
+    }
+
+    InlineUniquePtr& operator=(InlineUniquePtr&& other) noexcept {
+        if (this != &other) {
+            Clear();
+            GetDeleter() = std::move(other.GetDeleter());
+            TakeFrom(other);
+        }
+        return *this;
+    }
+
+    InlineUniquePtr& operator=(std::nullptr_t) noexcept {
+        Clear();
+        return *this;
+    }
+
+    ~InlineUniquePtr() {
+        Clear();
+    }
+
+    // Replaces the object with a D built from args, inline if it fits.
+    template <typename D, typename... Args>
+    D& Emplace(Args&&... args) {
+        static_assert(std::is_convertible_v<D*, Base*>);
+        Clear();
+        D* object;
+        if constexpr (kFitsInline<D>) {
+            object = ::new (Buffer()) D(std::forward<Args>(args)...);
+            manager_ = &Manage<D>;
+        } else {
+            static_assert(kDefaultDeleter, "a heap D is allocated with new");
+            static_assert(std::is_same_v<D, Base> || std::has_virtual_destructor_v<Base>,
+                          "a heap D is freed through Base*");
+            object = new D(std::forward<Args>(args)...);
+        }
+        Ptr() = object;
+        return *object;
+    }
+
+    // Gives up ownership. An inline object is first moved to the heap with
+    // new, so the result can always be passed to Deleter.
+    Base* Release() {
+        static_assert(kDefaultDeleter, "an inline object is released with new");
+        Base* ptr = Ptr();
+        if (manager_) {
+            ptr = manager_(Op::kRelease, this, nullptr);
+            manager_ = nullptr;
+        }
+        Ptr() = nullptr;
+        return ptr;
+    }
+
+    void Reset() noexcept {
+        Clear();
+    }
+
+    void Reset(Base* ptr) noexcept {
+        Clear();
+        Ptr() = ptr;
+    }
+
+    void Swap(InlineUniquePtr& other) noexcept {
+        InlineUniquePtr temp(std::move(other));
+        other = std::move(*this);
+        *this = std::move(temp);
+    }
+
+    Base* Get() const {
+        return value_.first();
+    }
+
+    bool IsInline() const {
+        return manager_ != nullptr;
+    }
+
+    explicit operator bool() const {
+        return Get() != nullptr;
+    }
+
+    std::add_lvalue_reference_t<Base> operator*() const {
+        return *Get();
+    }
+    Base* operator->() const {
+        return Get();
+    }
+
+    Deleter& GetDeleter() {
+        return value_.second();
+    }
+    const Deleter& GetDeleter() const {
+        return value_.second();
+    }
+
+private:
+    using Storage = std::aligned_storage_t<N, Align>;
+
+    static constexpr bool kDefaultDeleter = std::is_same_v<Deleter, Slug<Base>>;
+
+    enum class Op {
+        kMove,
+        kDestroy,
+        kRelease,
+    };
+
+    // Knows the inline object's real type: kMove moves it from self into
+    // other's buffer, kDestroy destroys it, kRelease moves it to the heap.
+    // All three end the object in self's buffer.
+    using Manager = Base* (*)(Op, InlineUniquePtr* self, InlineUniquePtr* other);
+
+    template <typename D>
+    static Base* Manage(Op op, InlineUniquePtr* self, InlineUniquePtr* other) {
+        D* object = std::launder(reinterpret_cast<D*>(self->Buffer()));
+        Base* result = nullptr;
+        switch (op) {
+            case Op::kMove:
+                result = ::new (other->Buffer()) D(std::move(*object));
+                break;
+            case Op::kDestroy:
+                break;
+            case Op::kRelease:
+                if constexpr (kDefaultDeleter) {
+                    static_assert(std::is_same_v<D, Base> || std::has_virtual_destructor_v<Base>,
+                                  "a released D is freed through Base*");
+                    result = new D(std::move(*object));
+                }
+                break;
+        }
+        std::destroy_at(object);
+        return result;
+    }
+
+    void* Buffer() {
+        return &storage_;
+    }
+
+    Base*& Ptr() {
+        return value_.first();
+    }
+
+    void TakeFrom(InlineUniquePtr& other) noexcept {
+        if (other.manager_) {
+            Ptr() = other.manager_(Op::kMove, &other, this);
+        } else {
+            Ptr() = other.Get();
+        }
+        manager_ = other.manager_;
+        other.Ptr() = nullptr;
+        other.manager_ = nullptr;
+    }
+
+    void Clear() noexcept {
+        if (manager_) {
+            manager_(Op::kDestroy, this, nullptr);
+            manager_ = nullptr;
+        } else if (Get()) {
+            GetDeleter()(Get());
+        }
+        Ptr() = nullptr;
+    }
+
+private:
+    // Left uninitialised: only an inline object ever occupies it.
+    Storage storage_;
+    compressed_pair<Base*, Deleter> value_;
+    Manager manager_ = nullptr;
+};
+
+template <typename Base, typename D, size_t N = 32, size_t Align = alignof(std::max_align_t), typename... Args>
+InlineUniquePtr<Base, N, Align> MakeInlineUnique(Args&&... args) {
+    InlineUniquePtr<Base, N, Align> ptr;
+    ptr.template Emplace<D>(std::forward<Args>(args)...);
+    return ptr;
+}
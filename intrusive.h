@@ -0,0 +1,178 @@
+#pragma once
+
+#include "sw_fwd.h"
+
+#include <cstddef>  // std::nullptr_t
+
+// Single-word owning handle for objects that keep their own reference count.
+// The count is managed through IntrusiveAddRef(p) / IntrusiveRelease(p), found
+// by argument-dependent lookup; RefCounted provides both, and a type may also
+// define its own.
+template <typename T>
+class IntrusivePtr {
+public:
+    template <typename U>
+    friend class IntrusivePtr;
+
+    using TriviallyRelocatable = std::true_type;
+
+public:
+    IntrusivePtr() noexcept {
+    }
+
+    IntrusivePtr(std::nullptr_t) noexcept {
+    }
+
+    // With add_ref == false the handle adopts a reference the caller already owns.
+    explicit IntrusivePtr(T* ptr, bool add_ref = true) : ptr_(ptr) {
+        if (ptr_ && add_ref) {
+            IntrusiveAddRef(ptr_);
+        }
+    }
+
+    IntrusivePtr(const IntrusivePtr& other) : ptr_(other.ptr_) {
+        if (ptr_) {
+            IntrusiveAddRef(ptr_);
+        }
+    }
+
+    template <typename U>
+    IntrusivePtr(const IntrusivePtr<U>& other) : ptr_(other.ptr_) {
+        if (ptr_) {
+            IntrusiveAddRef(ptr_);
+        }
+    }
+
+    IntrusivePtr(IntrusivePtr&& other) noexcept : ptr_(other.ptr_) {
+        other.ptr_ = nullptr;
+    }
+
+    template <typename U>
+    IntrusivePtr(IntrusivePtr<U>&& other) noexcept : ptr_(other.ptr_) {
+        other.ptr_ = nullptr;
+    }
+
+    IntrusivePtr& operator=(const IntrusivePtr& other) {
+        IntrusivePtr(other).Swap(*this);
+        return *this;
+    }
+
+    template <typename U>
+    IntrusivePtr& operator=(const IntrusivePtr<U>& other) {
+        IntrusivePtr(other).Swap(*this);
+        return *this;
+    }
+
+    IntrusivePtr& operator=(IntrusivePtr&& other) noexcept {
+        IntrusivePtr(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    template <typename U>
+    IntrusivePtr& operator=(IntrusivePtr<U>&& other) noexcept {
+        IntrusivePtr(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ~IntrusivePtr() {
+        if (ptr_) {
+            IntrusiveRelease(ptr_);
+        }
+    }
+
+    void Reset() {
+        IntrusivePtr().Swap(*this);
+    }
+
+    void Reset(T* ptr) {
+        IntrusivePtr(ptr).Swap(*this);
+    }
+
+    // Gives up ownership without touching the count.
+    T* Release() {
+        T* ptr = ptr_;
+        ptr_ = nullptr;
+        return ptr;
+    }
+
+    void Swap(IntrusivePtr& other) noexcept {
+        std::swap(ptr_, other.ptr_);
+    }
+
+    T* Get() const {
+        return ptr_;
+    }
+
+    T& operator*() const {
+        return *ptr_;
+    }
+    T* operator->() const {
+        return ptr_;
+    }
+    size_t UseCount() const {
+        return ptr_ ? ptr_->RefCount() : 0;
+    }
+    explicit operator bool() const {
+        return ptr_;
+    }
+
+    template <typename U>
+    bool operator==(const IntrusivePtr<U>& right) const {
+        return ptr_ == right.ptr_;
+    }
+
+private:
+    T* ptr_ = nullptr;
+};
+
+// Embeds the count in Derived, in the EnableSharedFromThis style: inherit from
+// RefCounted<Derived, Policy> and hand out IntrusivePtr<Derived>. The policy is
+// one of the counting policies from sw_fwd.h. Copying an object does not copy
+// its count.
+template <typename Derived, typename Policy = SingleThreadedPolicy>
+class RefCounted {
+public:
+    static_assert(!Policy::kDeferredRelease, "RefCounted has no control block to bind a deferred counter to");
+
+    IntrusivePtr<Derived> IntrusiveFromThis() {
+        return IntrusivePtr<Derived>(static_cast<Derived*>(this));
+    }
+    IntrusivePtr<const Derived> IntrusiveFromThis() const {
+        return IntrusivePtr<const Derived>(static_cast<const Derived*>(this));
+    }
+
+    size_t RefCount() const {
+        return counter_.Load();
+    }
+
+    friend void IntrusiveAddRef(const RefCounted* ptr) {
+        ptr->counter_.Increment();
+    }
+
+    friend void IntrusiveRelease(const RefCounted* ptr) {
+        if (ptr->counter_.Decrement()) {
+            delete static_cast<const Derived*>(ptr);
+        }
+    }
+
+protected:
+    RefCounted() {
+    }
+
+    RefCounted(const RefCounted&) {
+    }
+
+    RefCounted& operator=(const RefCounted&) {
+        return *this;
+    }
+
+    ~RefCounted() = default;
+
+private:
+    mutable typename Policy::StrongCounter counter_{0};
+};
+
+template <typename T, typename... Args>
+IntrusivePtr<T> MakeIntrusive(Args&&... args) {
+    return IntrusivePtr<T>(new T(std::forward<Args>(args)...));
+}
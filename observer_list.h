@@ -0,0 +1,111 @@
+#pragma once
+
+#include "atomic_shared.h"
+#include "weak.h"
+
+#include <atomic>
+#include <iterator>
+#include <mutex>
+#include <vector>
+
+// Subscriber list for event dispatch that holds its observers weakly.
+// Publishers iterate an immutable snapshot loaded from an AtomicSharedPtr, so
+// they never take a lock and never wait for writers or for each other.
+// Subscribe and Unsubscribe copy the snapshot, edit the copy and publish it
+// under a writer mutex.
+//
+// Observers that have died are skipped and left in place. A publisher that
+// finds a quarter of the snapshot dead asks for a compaction, which runs in
+// one batch if the writer mutex is free and is otherwise left to the next
+// writer.
+template <typename T>
+class WeakObserverList {
+public:
+    using Observer = SharedPtr<T, AtomicPolicy>;
+    using Entries = std::vector<WeakPtr<T, AtomicPolicy>>;
+
+    WeakObserverList() : entries_(MakeShared<const Entries, AtomicPolicy>()) {
+    }
+
+    WeakObserverList(const WeakObserverList&) = delete;
+    WeakObserverList& operator=(const WeakObserverList&) = delete;
+
+    void Subscribe(const Observer& observer) {
+        std::lock_guard<std::mutex> lock(writer_mutex_);
+        Entries entries = CopyLive();
+        entries.emplace_back(observer);
+        Publish(std::move(entries));
+    }
+
+    // Removes every subscription of observer's object.
+    void Unsubscribe(const Observer& observer) {
+        std::lock_guard<std::mutex> lock(writer_mutex_);
+        Entries entries = CopyLive();
+        for (auto it = entries.begin(); it != entries.end();) {
+            it = it->OwnerId() == observer.OwnerId() ? entries.erase(it) : std::next(it);
+        }
+        Publish(std::move(entries));
+    }
+
+    // Calls f(T&) for every live observer and returns how many there were.
+    template <typename F>
+    size_t ForEach(F&& f) {
+        SharedPtr<const Entries, AtomicPolicy> snapshot = entries_.Load();
+        size_t live = 0;
+        size_t dead = 0;
+        Observer observer;
+        for (const WeakPtr<T, AtomicPolicy>& entry : *snapshot) {
+            if (observer.TryLock(entry)) {
+                f(*observer);
+                ++live;
+            } else {
+                ++dead;
+            }
+        }
+        if (dead > 0 && 4 * dead >= snapshot->size()) {
+            TryCompact();
+        }
+        return live;
+    }
+
+    // Drops expired observers now.
+    void Compact() {
+        std::lock_guard<std::mutex> lock(writer_mutex_);
+        Publish(CopyLive());
+    }
+
+    // Subscriptions in the current snapshot, including dead ones.
+    size_t Size() const {
+        return entries_.Load()->size();
+    }
+
+private:
+    void TryCompact() {
+        std::unique_lock<std::mutex> lock(writer_mutex_, std::try_to_lock);
+        if (lock.owns_lock()) {
+            Publish(CopyLive());
+        }
+    }
+
+    // Compacts as a side effect of every write, so writers never republish
+    // dead entries.
+    Entries CopyLive() const {
+        SharedPtr<const Entries, AtomicPolicy> snapshot = entries_.Load();
+        Entries entries;
+        entries.reserve(snapshot->size() + 1);
+        for (const WeakPtr<T, AtomicPolicy>& entry : *snapshot) {
+            if (!entry.Expired()) {
+                entries.push_back(entry);
+            }
+        }
+        return entries;
+    }
+
+    void Publish(Entries entries) {
+        entries_.Store(MakeShared<const Entries, AtomicPolicy>(std::move(entries)));
+    }
+
+private:
+    AtomicSharedPtr<const Entries> entries_;
+    std::mutex writer_mutex_;
+};
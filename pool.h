@@ -0,0 +1,252 @@
+#pragma once
+
+#include "thread_registry.h"
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <new>
+
+// Slab pool for small fixed-size blocks such as control blocks. Sizes are
+// rounded up to 16-byte classes. Each thread allocates from and frees to its
+// own free lists without locking, whichever thread allocated the block; a
+// list that runs dry refills a batch from the global list, and one that grows
+// too long spills a batch back. Slabs are carved on demand and kept for the
+// life of the process. Requests larger than kMaxSize go to operator new.
+class BlockPool {
+public:
+    static constexpr size_t kAlignment = 16;
+    static constexpr size_t kMaxSize = 256;
+
+    struct Stats {
+        size_t allocations = 0;
+        size_t deallocations = 0;
+        size_t cache_hits = 0;
+        size_t refills = 0;
+        size_t spills = 0;
+        size_t slabs = 0;
+        size_t bytes_reserved = 0;
+    };
+
+    static void* Allocate(size_t size) {
+        if (size > kMaxSize) {
+            return ::operator new(size);
+        }
+        size_t index = ClassOf(size);
+        ThreadCache* cache = LocalCache();
+        if (!cache) {
+            return GetGlobal().Take(index, 1);
+        }
+
+        Bump(cache->allocations);
+        FreeNode*& head = cache->heads[index];
+        if (head) {
+            Bump(cache->cache_hits);
+        } else {
+            head = GetGlobal().Take(index, kBatch);
+            cache->counts[index] += kBatch;
+        }
+        FreeNode* node = head;
+        head = node->next;
+        --cache->counts[index];
+        return node;
+    }
+
+    static void Deallocate(void* ptr, size_t size) {
+        if (size > kMaxSize) {
+            ::operator delete(ptr);
+            return;
+        }
+        size_t index = ClassOf(size);
+        FreeNode* node = static_cast<FreeNode*>(ptr);
+        ThreadCache* cache = LocalCache();
+        if (!cache) {
+            node->next = nullptr;
+            GetGlobal().Put(index, node, node);
+            return;
+        }
+
+        Bump(cache->deallocations);
+        node->next = cache->heads[index];
+        cache->heads[index] = node;
+        if (++cache->counts[index] > kCacheLimit) {
+            cache->Spill(index, kBatch);
+        }
+    }
+
+    // Whether blocks of the two sizes share free lists, so that one allocated
+    // with either size may be freed with the other.
+    static constexpr bool SameClass(size_t left, size_t right) {
+        if (left > kMaxSize || right > kMaxSize) {
+            return left > kMaxSize && right > kMaxSize;
+        }
+        return ClassOf(left) == ClassOf(right);
+    }
+
+    // Sums the live threads' counters with those of threads that exited.
+    static Stats GetStats() {
+        Global& global = GetGlobal();
+        std::lock_guard<std::mutex> registry_lock(Registry::Mutex());
+        Stats stats = global.retired;
+        Registry::ForEach([&stats](const ThreadCache& cache) { cache.AddTo(stats); });
+        std::lock_guard<std::mutex> lock(global.mutex);
+        stats.refills = global.refills;
+        stats.spills = global.spills;
+        stats.slabs = global.slabs;
+        stats.bytes_reserved = global.slabs * kSlabSize;
+        return stats;
+    }
+
+private:
+    static constexpr size_t kClassCount = kMaxSize / kAlignment;
+    static constexpr size_t kBatch = 32;
+    static constexpr size_t kCacheLimit = 2 * kBatch;
+    static constexpr size_t kSlabSize = 64 * 1024;
+
+    struct FreeNode {
+        FreeNode* next;
+    };
+
+    // Only the owning thread writes these; GetStats reads them concurrently.
+    using Counter = std::atomic<size_t>;
+
+    static void Bump(Counter& counter) {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    static constexpr size_t ClassOf(size_t size) {
+        return size == 0 ? 0 : (size - 1) / kAlignment;
+    }
+
+    struct ThreadCache;
+    using Registry = ThreadRegistry<ThreadCache>;
+
+    // The free lists and refill figures are guarded by mutex; retired, the
+    // counters of exited threads, by Registry::Mutex().
+    struct Global {
+        std::mutex mutex;
+        FreeNode* heads[kClassCount] = {};
+        Stats retired;
+        size_t refills = 0;
+        size_t spills = 0;
+        size_t slabs = 0;
+
+        // Returns a null-terminated list of count nodes.
+        FreeNode* Take(size_t index, size_t count) {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++refills;
+            FreeNode* result = nullptr;
+            for (size_t i = 0; i < count; ++i) {
+                if (!heads[index]) {
+                    Carve(index);
+                }
+                FreeNode* node = heads[index];
+                heads[index] = node->next;
+                node->next = result;
+                result = node;
+            }
+            return result;
+        }
+
+        void Put(size_t index, FreeNode* first, FreeNode* last) {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++spills;
+            last->next = heads[index];
+            heads[index] = first;
+        }
+
+        void Carve(size_t index) {
+            size_t size = (index + 1) * kAlignment;
+            char* slab = static_cast<char*>(::operator new(kSlabSize));
+            ++slabs;
+            for (size_t offset = 0; offset + size <= kSlabSize; offset += size) {
+                FreeNode* node = reinterpret_cast<FreeNode*>(slab + offset);
+                node->next = heads[index];
+                heads[index] = node;
+            }
+        }
+    };
+
+    struct ThreadCache {
+        FreeNode* heads[kClassCount] = {};
+        size_t counts[kClassCount] = {};
+        Counter allocations{0};
+        Counter deallocations{0};
+        Counter cache_hits{0};
+
+        // Runs after Retire, once the thread can no longer reach this cache.
+        ~ThreadCache() {
+            for (size_t index = 0; index < kClassCount; ++index) {
+                Spill(index, counts[index]);
+            }
+        }
+
+        void Retire() {
+            AddTo(GetGlobal().retired);
+        }
+
+        void Spill(size_t index, size_t count) {
+            if (count == 0) {
+                return;
+            }
+            FreeNode* first = heads[index];
+            FreeNode* last = first;
+            for (size_t i = 1; i < count; ++i) {
+                last = last->next;
+            }
+            heads[index] = last->next;
+            counts[index] -= count;
+            GetGlobal().Put(index, first, last);
+        }
+
+        void AddTo(Stats& stats) const {
+            stats.allocations += allocations.load(std::memory_order_relaxed);
+            stats.deallocations += deallocations.load(std::memory_order_relaxed);
+            stats.cache_hits += cache_hits.load(std::memory_order_relaxed);
+        }
+    };
+
+    // Never destroyed, so blocks freed during static destruction still work.
+    static Global& GetGlobal() {
+        static Global* global = new Global();
+        return *global;
+    }
+
+    // Null once the thread's cache has been torn down.
+    static ThreadCache* LocalCache() {
+        return Registry::Local();
+    }
+};
+
+// Standard allocator over BlockPool, e.g. for AllocateShared.
+template <typename T>
+class PoolAllocator {
+public:
+    using value_type = T;
+
+    PoolAllocator() {
+    }
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>&) {
+    }
+
+    T* allocate(size_t n) {
+        static_assert(alignof(T) <= BlockPool::kAlignment);
+        return static_cast<T*>(BlockPool::Allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* ptr, size_t n) {
+        BlockPool::Deallocate(ptr, n * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>&) const {
+        return true;
+    }
+
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>&) const {
+        return false;
+    }
+};
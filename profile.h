@@ -0,0 +1,129 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+// Sampling profiler for count traffic. Off unless SMART_POINTERS_PROFILE is
+// defined; even then nothing is recorded until Start(period). Each thread then
+// records every period-th count operation it performs, with the block, the
+// managed type and the thread. Report() ranks blocks by samples (how heavily
+// they are shared) or by handoffs, consecutive samples taken on different
+// threads, which approximates how often the count's cache line moves between
+// cores.
+//
+// Blocks are keyed by address, so a block freed and reallocated while
+// profiling shows up as one entry.
+#if defined(SMART_POINTERS_PROFILE)
+inline constexpr bool kProfileEnabled = true;
+#else
+inline constexpr bool kProfileEnabled = false;
+#endif
+
+class ContentionProfiler {
+public:
+    struct Entry {
+        const void* block = nullptr;
+        const std::type_info* type = nullptr;
+        size_t samples = 0;
+        size_t threads = 0;
+        size_t handoffs = 0;
+    };
+
+    enum class Order {
+        kSamples,
+        kHandoffs,
+    };
+
+    static void Start(size_t period) {
+        period_.store(period, std::memory_order_relaxed);
+    }
+
+    static void Stop() {
+        period_.store(0, std::memory_order_relaxed);
+    }
+
+    static void Clear() {
+        Global& global = GetGlobal();
+        std::lock_guard<std::mutex> lock(global.mutex);
+        global.blocks.clear();
+    }
+
+    template <typename Block>
+    static void Sample(Block* block) {
+        if constexpr (kProfileEnabled) {
+            size_t period = period_.load(std::memory_order_relaxed);
+            if (period == 0) {
+                return;
+            }
+            thread_local size_t countdown = 0;
+            if (++countdown < period) {
+                return;
+            }
+            countdown = 0;
+            Record(block, block->TypeInfo());
+        }
+    }
+
+    // The top k blocks in the given order.
+    static std::vector<Entry> Report(size_t k, Order order = Order::kSamples) {
+        std::vector<Entry> entries;
+        {
+            Global& global = GetGlobal();
+            std::lock_guard<std::mutex> lock(global.mutex);
+            entries.reserve(global.blocks.size());
+            for (const auto& [block, stats] : global.blocks) {
+                entries.push_back({block, stats.type, stats.samples, stats.threads.size(), stats.handoffs});
+            }
+        }
+        auto key = [order](const Entry& entry) { return order == Order::kSamples ? entry.samples : entry.handoffs; };
+        size_t top = std::min(k, entries.size());
+        std::partial_sort(entries.begin(), entries.begin() + top, entries.end(),
+                          [&key](const Entry& left, const Entry& right) { return key(left) > key(right); });
+        entries.resize(top);
+        return entries;
+    }
+
+private:
+    struct BlockStats {
+        const std::type_info* type = nullptr;
+        size_t samples = 0;
+        size_t handoffs = 0;
+        std::thread::id last_thread;
+        std::vector<std::thread::id> threads;
+    };
+
+    struct Global {
+        std::mutex mutex;
+        std::unordered_map<const void*, BlockStats> blocks;
+    };
+
+    static void Record(const void* block, const std::type_info& type) {
+        std::thread::id thread = std::this_thread::get_id();
+        Global& global = GetGlobal();
+        std::lock_guard<std::mutex> lock(global.mutex);
+        BlockStats& stats = global.blocks[block];
+        stats.type = &type;
+        if (stats.samples > 0 && stats.last_thread != thread) {
+            ++stats.handoffs;
+        }
+        ++stats.samples;
+        stats.last_thread = thread;
+        if (std::find(stats.threads.begin(), stats.threads.end(), thread) == stats.threads.end()) {
+            stats.threads.push_back(thread);
+        }
+    }
+
+    // Never destroyed, so blocks released during static destruction are safe.
+    static Global& GetGlobal() {
+        static Global* global = new Global();
+        return *global;
+    }
+
+    static inline std::atomic<size_t> period_{0};
+};
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// A type is trivially relocatable if moving it to new storage and ending the
+// old object's lifetime is equivalent to copying its bytes. Trivially copyable
+// types are; a class that knows it is, such as a smart pointer that only holds
+// raw pointers, says so with
+//
+//     using TriviallyRelocatable = std::true_type;
+template <typename T, typename = void>
+struct IsTriviallyRelocatable : std::is_trivially_copyable<T> {};
+
+template <typename T>
+struct IsTriviallyRelocatable<T, std::void_t<typename T::TriviallyRelocatable>>
+    : std::bool_constant<T::TriviallyRelocatable::value || std::is_trivially_copyable_v<T>> {};
+
+template <typename T>
+inline constexpr bool kTriviallyRelocatable = IsTriviallyRelocatable<T>::value;
+
+// Moves count objects from first into the uninitialised storage at dest and
+// ends their lifetimes. The ranges must not overlap.
+template <typename T>
+void RelocateN(T* first, size_t count, T* dest) noexcept {
+    if constexpr (kTriviallyRelocatable<T>) {
+        if (count > 0) {
+            std::memcpy(static_cast<void*>(dest), static_cast<const void*>(first), count * sizeof(T));
+        }
+    } else {
+        static_assert(std::is_nothrow_move_constructible_v<T>, "relocation must not throw");
+        for (size_t i = 0; i < count; ++i) {
+            ::new (static_cast<void*>(dest + i)) T(std::move(first[i]));
+            std::destroy_at(first + i);
+        }
+    }
+}
+
+// Minimal vector that grows by relocating, so trivially relocatable elements
+// are moved with one memcpy and no per-element work.
+template <typename T>
+class RelocatingVector {
+public:
+    static_assert(kTriviallyRelocatable<T> || std::is_nothrow_move_constructible_v<T>);
+
+    RelocatingVector() {
+    }
+
+    RelocatingVector(const RelocatingVector&) = delete;
+    RelocatingVector& operator=(const RelocatingVector&) = delete;
+
+    RelocatingVector(RelocatingVector&& other) noexcept
+        : data_(other.data_), size_(other.size_), capacity_(other.capacity_) {
+        other.data_ = nullptr;
+        other.size_ = 0;
+        other.capacity_ = 0;
+    }
+
+    RelocatingVector& operator=(RelocatingVector&& other) noexcept {
+        RelocatingVector(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ~RelocatingVector() {
+        Clear();
+        Free(data_);
+    }
+
+    void Reserve(size_t capacity) {
+        if (capacity <= capacity_) {
+            return;
+        }
+        T* data = Allocate(capacity);
+        RelocateN(data_, size_, data);
+        Free(data_);
+        data_ = data;
+        capacity_ = capacity;
+    }
+
+    template <typename... Args>
+    T& EmplaceBack(Args&&... args) {
+        if (size_ == capacity_) {
+            return GrowAndEmplaceBack(std::forward<Args>(args)...);
+        }
+        T* slot = ::new (static_cast<void*>(data_ + size_)) T(std::forward<Args>(args)...);
+        ++size_;
+        return *slot;
+    }
+
+    void PushBack(const T& value) {
+        EmplaceBack(value);
+    }
+
+    void PushBack(T&& value) {
+        EmplaceBack(std::move(value));
+    }
+
+    void PopBack() {
+        std::destroy_at(data_ + --size_);
+    }
+
+    void Clear() {
+        std::destroy(data_, data_ + size_);
+        size_ = 0;
+    }
+
+    void Swap(RelocatingVector& other) noexcept {
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        std::swap(capacity_, other.capacity_);
+    }
+
+    size_t Size() const {
+        return size_;
+    }
+    size_t Capacity() const {
+        return capacity_;
+    }
+    bool Empty() const {
+        return size_ == 0;
+    }
+
+    T& operator[](size_t i) {
+        return data_[i];
+    }
+    const T& operator[](size_t i) const {
+        return data_[i];
+    }
+
+    T* begin() {
+        return data_;
+    }
+    T* end() {
+        return data_ + size_;
+    }
+    const T* begin() const {
+        return data_;
+    }
+    const T* end() const {
+        return data_ + size_;
+    }
+
+private:
+    // args may refer to an element of this vector, so the new element is
+    // built in the new buffer before the old one is relocated and freed.
+    template <typename... Args>
+    T& GrowAndEmplaceBack(Args&&... args) {
+        size_t capacity = capacity_ == 0 ? 4 : 2 * capacity_;
+        T* data = Allocate(capacity);
+        T* slot;
+        try {
+            slot = ::new (static_cast<void*>(data + size_)) T(std::forward<Args>(args)...);
+        } catch (...) {
+            Free(data);
+            throw;
+        }
+        RelocateN(data_, size_, data);
+        Free(data_);
+        data_ = data;
+        capacity_ = capacity;
+        ++size_;
+        return *slot;
+    }
+
+    static T* Allocate(size_t capacity) {
+        return static_cast<T*>(::operator new(capacity * sizeof(T), std::align_val_t(alignof(T))));
+    }
+
+    static void Free(T* data) {
+        if (data) {
+            ::operator delete(data, std::align_val_t(alignof(T)));
+        }
+    }
+
+private:
+    T* data_ = nullptr;
+    size_t size_ = 0;
+    size_t capacity_ = 0;
+};
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "shared.h"
+
+#include <atomic>
+#include <cstdint>
+
+// Sharded reference counting in the style of Linux percpu-refcount. While the
+// block is live, every thread counts on its own cache line, so copying a hot
+// global object never bounces a shared line between cores. Shards may go
+// negative; only their sum is meaningful, and a base reference held by the
+// block itself keeps that sum positive. Kill() folds the shards into one
+// atomic count and drops the base reference; from then on the counter behaves
+// like AtomicPolicy and the last Decrement() releases the object.
+//
+// An object that is never killed is never released.
+class ShardedPolicy {
+public:
+    static constexpr bool kDeferredRelease = true;
+
+    class StrongCounter {
+    public:
+        explicit StrongCounter(size_t value = 0) : central_(kBase + static_cast<int64_t>(value)) {
+        }
+
+        void Bind(IControlBlock<ShardedPolicy>* block) {
+            block_ = block;
+        }
+
+        void Increment() {
+            if (!AddToShard(1)) {
+                central_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        bool Decrement() {
+            if (AddToShard(-1)) {
+                return false;
+            }
+            if (central_.fetch_sub(1, std::memory_order_release) == 1) {
+                std::atomic_thread_fence(std::memory_order_acquire);
+                return true;
+            }
+            return false;
+        }
+
+        bool IncrementIfNonZero() {
+            // A live block still holds its base reference.
+            if (AddToShard(1)) {
+                return true;
+            }
+            int64_t value = central_.load(std::memory_order_relaxed);
+            do {
+                if (value == 0) {
+                    return false;
+                }
+            } while (!central_.compare_exchange_weak(value, value + 1, std::memory_order_acquire,
+                                                     std::memory_order_relaxed));
+            return true;
+        }
+
+        size_t Load() const {
+            int64_t count = central_.load(std::memory_order_relaxed);
+            if (!killed_.load(std::memory_order_relaxed)) {
+                count -= kBase;
+                for (const Shard& shard : shards_) {
+                    int64_t value = shard.value.load(std::memory_order_relaxed);
+                    if (value != kDead) {
+                        count += value;
+                    }
+                }
+            }
+            return count > 0 ? static_cast<size_t>(count) : 0;
+        }
+
+        // Switches to a single atomic count and drops the base reference.
+        // Idempotent; safe to race with count operations on other threads.
+        void Kill() {
+            if (killed_.exchange(true, std::memory_order_acq_rel)) {
+                return;
+            }
+            // A dead shard diverts its thread to central_, so every shard
+            // operation lands either before the fold or on central_. The base
+            // stays in central_ until the end, so it cannot reach zero early.
+            for (Shard& shard : shards_) {
+                central_.fetch_add(shard.value.exchange(kDead, std::memory_order_acq_rel),
+                                   std::memory_order_relaxed);
+            }
+            if (central_.fetch_sub(kBase, std::memory_order_acq_rel) == kBase) {
+                block_->ReleaseStrong();
+            }
+        }
+
+    private:
+        // Far larger than any real count, so folding negative shards in before
+        // positive ones can never bring central_ to zero.
+        static constexpr int64_t kBase = int64_t(1) << 48;
+        static constexpr int64_t kDead = INT64_MIN;
+        static constexpr size_t kShardCount = 32;
+        static constexpr size_t kCacheLine = 64;
+
+        struct alignas(kCacheLine) Shard {
+            std::atomic<int64_t> value{0};
+        };
+
+        static size_t ThisThreadShard() {
+            static std::atomic<size_t> next{0};
+            thread_local size_t shard = next.fetch_add(1, std::memory_order_relaxed) % kShardCount;
+            return shard;
+        }
+
+        // Returns false once the shard is dead.
+        bool AddToShard(int64_t delta) {
+            std::atomic<int64_t>& value = shards_[ThisThreadShard()].value;
+            int64_t current = value.load(std::memory_order_relaxed);
+            do {
+                if (current == kDead) {
+                    return false;
+                }
+            } while (!value.compare_exchange_weak(current, current + delta, std::memory_order_release,
+                                                  std::memory_order_relaxed));
+            return true;
+        }
+
+    private:
+        Shard shards_[kShardCount];
+        std::atomic<int64_t> central_;
+        std::atomic<bool> killed_{false};
+        IControlBlock<ShardedPolicy>* block_ = nullptr;
+    };
+
+    using WeakCounter = AtomicPolicy::Counter;
+
+    template <typename T>
+    static void Kill(const SharedPtr<T, ShardedPolicy>& ptr) {
+        if (ptr.control_block_) {
+            ptr.control_block_->counter_strong_.Kill();
+        }
+    }
+};
+
+template <typename T, typename... Args>
+SharedPtr<T, ShardedPolicy> MakeSharedSharded(Args&&... args) {
+    return MakeShared<T, ShardedPolicy>(std::forward<Args>(args)...);
+}
+
+template <typename T>
+void KillSharded(const SharedPtr<T, ShardedPolicy>& ptr) {
+    ShardedPolicy::Kill(ptr);
+}
@@ -3,25 +3,35 @@
 #include "sw_fwd.h"  // Forward declaration
 
 #include <cstddef>  // std::nullptr_t
+#include <type_traits>
 
-template <typename T>
+template <typename T, typename Policy>
 class SharedPtr {
 public:
-    template <typename U>
+    template <typename U, typename P>
     friend class SharedPtr;
-    template <typename U>
+    template <typename U, typename P>
     friend class WeakPtr;
+    template <typename U, typename P>
+    friend class CompactSharedPtr;
+    friend Policy;
+
+public:
+    using ElementType = std::remove_extent_t<T>;
+    // Holds only raw pointers, so containers may move it with memcpy.
+    using TriviallyRelocatable = std::true_type;
 
 public:
 
-    SharedPtr() {
+    SharedPtr() noexcept {
     }
 
-    SharedPtr(std::nullptr_t) {
+    SharedPtr(std::nullptr_t) noexcept {
     }
 
-    explicit SharedPtr(T* ptr) {
-        control_block_ = new ControlBlockIndirect<T>(ptr);
+    // Slug<T> is delete[] for SharedPtr<T[]>.
+    explicit SharedPtr(ElementType* ptr) {
+        control_block_ = new ControlBlockIndirect<ElementType, Policy, Slug<T>>(ptr);
         control_block_->IncRefStrong();
         ptr_ = ptr;
 
@@ -31,7 +41,7 @@ public:
         }
     }
 
-    explicit SharedPtr(IControlBlock* control_block, T* ptr) {
+    explicit SharedPtr(IControlBlock<Policy>* control_block, ElementType* ptr) {
         control_block_ = control_block;
         control_block_->IncRefStrong();
         ptr_ = ptr;
@@ -43,7 +53,7 @@ public:
     }
 
     template <typename Y>
-    explicit SharedPtr(IControlBlock* control_block, Y* ptr) {
+    explicit SharedPtr(IControlBlock<Policy>* control_block, Y* ptr) {
         control_block_ = control_block;
         control_block_->IncRefStrong();
         ptr_ = ptr;
@@ -56,7 +66,43 @@ public:
 
     template <typename Y>
     explicit SharedPtr(Y* ptr) {
-        control_block_ = new ControlBlockIndirect<Y>(ptr);
+        control_block_ = new ControlBlockIndirect<Y, Policy>(ptr);
+        control_block_->IncRefStrong();
+        ptr_ = ptr;
+
+        if constexpr (std::is_convertible_v<Y*, ESFTBase*>) {
+            ptr_->ptr_.control_block_ = control_block_;
+            ptr_->ptr_.ptr_ = ptr_;
+        }
+    }
+
+    template <typename Y, typename Deleter>
+    SharedPtr(Y* ptr, Deleter deleter) {
+        try {
+            control_block_ = new ControlBlockIndirect<Y, Policy, Deleter>(ptr, deleter);
+        } catch (...) {
+            deleter(ptr);
+            throw;
+        }
+        control_block_->IncRefStrong();
+        ptr_ = ptr;
+
+        if constexpr (std::is_convertible_v<Y*, ESFTBase*>) {
+            ptr_->ptr_.control_block_ = control_block_;
+            ptr_->ptr_.ptr_ = ptr_;
+        }
+    }
+
+    // The deleter and allocator are kept in the control block; the block
+    // itself is allocated from alloc and freed through it.
+    template <typename Y, typename Deleter, typename Alloc>
+    SharedPtr(Y* ptr, Deleter deleter, Alloc alloc) {
+        try {
+            control_block_ = ControlBlockIndirectAlloc<Y, Deleter, Alloc, Policy>::Create(ptr, deleter, alloc);
+        } catch (...) {
+            deleter(ptr);
+            throw;
+        }
         control_block_->IncRefStrong();
         ptr_ = ptr;
 
@@ -67,7 +113,7 @@ public:
     }
 
     template <typename U>
-    SharedPtr(const SharedPtr<U>& other) {
+    SharedPtr(const SharedPtr<U, Policy>& other) {
         control_block_ = other.control_block_;
         ptr_ = other.ptr_;
 
@@ -86,7 +132,7 @@ public:
     }
 
     template <typename U>
-    SharedPtr(SharedPtr<U>&& other) {
+    SharedPtr(SharedPtr<U, Policy>&& other) noexcept {
         control_block_ = other.control_block_;
         ptr_ = other.ptr_;
 
@@ -94,7 +140,7 @@ public:
         other.ptr_ = nullptr;
     }
 
-    SharedPtr(SharedPtr&& other) {
+    SharedPtr(SharedPtr&& other) noexcept {
         control_block_ = other.control_block_;
         ptr_ = other.ptr_;
 
@@ -103,7 +149,7 @@ public:
     }
 
     template <typename Y>
-    SharedPtr(const SharedPtr<Y>& other, T* ptr) {
+    SharedPtr(const SharedPtr<Y, Policy>& other, ElementType* ptr) {
         control_block_ = other.control_block_;
         ptr_ = ptr;
 
@@ -112,21 +158,24 @@ public:
         }
     }
 
-    explicit SharedPtr(const WeakPtr<T>& other) {
+    // Steals other's reference, so the counts are not touched.
+    template <typename Y>
+    SharedPtr(SharedPtr<Y, Policy>&& other, ElementType* ptr) noexcept {
         control_block_ = other.control_block_;
-        ptr_ = other.ptr_;
+        ptr_ = ptr;
 
-        if (other.Expired()) {
-            throw BadWeakPtr();
-        }
+        other.control_block_ = nullptr;
+        other.ptr_ = nullptr;
+    }
 
-        if (control_block_) {
-            control_block_->IncRefStrong();
+    explicit SharedPtr(const WeakPtr<T, Policy>& other) {
+        if (!TryLock(other)) {
+            throw BadWeakPtr();
         }
     }
 
     template <typename U>
-    SharedPtr& operator=(const SharedPtr<U>& other) {
+    SharedPtr& operator=(const SharedPtr<U, Policy>& other) {
         DecRef();
         control_block_ = other.control_block_;
         ptr_ = other.ptr_;
@@ -149,7 +198,7 @@ public:
     }
 
     template <typename U>
-    SharedPtr& operator=(SharedPtr<U>&& other) {
+    SharedPtr& operator=(SharedPtr<U, Policy>&& other) noexcept {
         DecRef();
 
         control_block_ = other.control_block_;
@@ -161,7 +210,7 @@ public:
         return *this;
     }
 
-    SharedPtr& operator=(SharedPtr&& other) {
+    SharedPtr& operator=(SharedPtr&& other) noexcept {
         if (this != &other) {
             DecRef();
 
@@ -183,10 +232,10 @@ public:
         DecRef();
     }
 
-    void Reset(T* ptr) {
+    void Reset(ElementType* ptr) {
         DecRef();
 
-        control_block_ = new ControlBlockIndirect<T>(ptr);
+        control_block_ = new ControlBlockIndirect<ElementType, Policy, Slug<T>>(ptr);
         control_block_->IncRefStrong();
         ptr_ = ptr;
     }
@@ -195,35 +244,72 @@ public:
     void Reset(U* ptr) {
         DecRef();
 
-        control_block_ = new ControlBlockIndirect<U>(ptr);
+        control_block_ = new ControlBlockIndirect<U, Policy>(ptr);
         control_block_->IncRefStrong();
         ptr_ = ptr;
     }
 
-    void Swap(SharedPtr& other) {
+    template <typename U, typename Deleter>
+    void Reset(U* ptr, Deleter deleter) {
+        SharedPtr(ptr, std::move(deleter)).Swap(*this);
+    }
+
+    template <typename U, typename Deleter, typename Alloc>
+    void Reset(U* ptr, Deleter deleter, Alloc alloc) {
+        SharedPtr(ptr, std::move(deleter), std::move(alloc)).Swap(*this);
+    }
+
+    // Non-throwing upgrade: takes a strong reference if the object is still
+    // alive, otherwise leaves the pointer empty.
+    bool TryLock(const WeakPtr<T, Policy>& other) {
+        IControlBlock<Policy>* control_block = other.control_block_;
+        ElementType* ptr = other.ptr_;
+        if (!control_block || !control_block->TryIncRefStrong()) {
+            DecRef();
+            return false;
+        }
+
+        DecRef();
+        control_block_ = control_block;
+        ptr_ = ptr;
+        return true;
+    }
+
+    void Swap(SharedPtr& other) noexcept {
         std::swap(control_block_, other.control_block_);
         std::swap(ptr_, other.ptr_);
     }
 
-    T* Get() const {
+    friend void swap(SharedPtr& left, SharedPtr& right) noexcept {
+        left.Swap(right);
+    }
+
+    ElementType* Get() const {
         return ptr_;
     }
 
-    T& operator*() const {
+    ElementType& operator*() const {
         return *ptr_;
     }
-    T* operator->() const {
+    ElementType* operator->() const {
         return ptr_;
     }
+    ElementType& operator[](size_t i) const {
+        return ptr_[i];
+    }
     size_t UseCount() const {
         return control_block_ ? control_block_->RefCount() : 0;
     }
+    // Identifies the owning control block; see OwnerHash and OwnerLess.
+    const void* OwnerId() const noexcept {
+        return control_block_;
+    }
     explicit operator bool() const {
         return control_block_;
     }
 
     template <typename U>
-    bool operator==(const SharedPtr<U>& right) const {
+    bool operator==(const SharedPtr<U, Policy>& right) const {
         return control_block_ == right.control_block_ && ptr_ == right.ptr_;
     }
 
@@ -231,21 +317,136 @@ private:
     void DecRef() {
         if (control_block_) {
             control_block_->DecRefStrong();
-            if (control_block_->TotalCount() == 0) {
-                delete control_block_;
-            }
             control_block_ = nullptr;
             ptr_ = nullptr;
         }
     }
 
 private:
-    IControlBlock* control_block_ = nullptr;
-    T* ptr_ = nullptr;
+    IControlBlock<Policy>* control_block_ = nullptr;
+    ElementType* ptr_ = nullptr;
 };
 
-template <typename T, typename... Args>
-SharedPtr<T> MakeShared(Args&&... args) {
-    auto block = new ControlBlockDirect<T>(std::forward<Args>(args)...);
-    return SharedPtr<T>(block, block->GetRef());
+template <typename T, typename Policy = SingleThreadedPolicy, typename... Args>
+std::enable_if_t<!std::is_array_v<T>, SharedPtr<T, Policy>> MakeShared(Args&&... args) {
+    auto block = new ControlBlockDirect<T, Policy>(std::forward<Args>(args)...);
+    return SharedPtr<T, Policy>(static_cast<IControlBlock<Policy>*>(block), block->GetRef());
+}
+
+// Objects above this size are split from their control block by MakeSharedSplit.
+inline constexpr size_t kSplitThreshold = 1024;
+
+// MakeShared keeps the object inside the control block, so its storage lives
+// until the last WeakPtr goes. MakeSharedSplit does the same for small
+// objects, but allocates larger ones separately, which frees their memory as
+// soon as the last SharedPtr goes.
+template <typename T, typename Policy = SingleThreadedPolicy, typename... Args>
+std::enable_if_t<!std::is_array_v<T>, SharedPtr<T, Policy>> MakeSharedSplit(Args&&... args) {
+    if constexpr (sizeof(T) <= kSplitThreshold) {
+        return MakeShared<T, Policy>(std::forward<Args>(args)...);
+    } else {
+        return SharedPtr<T, Policy>(new T(std::forward<Args>(args)...), Slug<T>());
+    }
+}
+
+template <typename T, typename Policy = SingleThreadedPolicy, typename Alloc, typename... Args>
+SharedPtr<T, Policy> AllocateShared(const Alloc& alloc, Args&&... args) {
+    auto block = ControlBlockDirectAlloc<T, Alloc, Policy>::Create(alloc, std::forward<Args>(args)...);
+    return SharedPtr<T, Policy>(static_cast<IControlBlock<Policy>*>(block), block->GetRef());
+}
+
+// Like MakeShared, but hook() is called once the object has been destroyed,
+// when the strong count reaches zero.
+template <typename T, typename Policy = SingleThreadedPolicy, typename Hook, typename... Args>
+SharedPtr<T, Policy> MakeSharedWithExpiry(Hook hook, Args&&... args) {
+    auto block = new ControlBlockExpiry<T, Hook, Policy>(std::move(hook), std::forward<Args>(args)...);
+    return SharedPtr<T, Policy>(static_cast<IControlBlock<Policy>*>(block), block->GetRef());
+}
+
+// Arrays are placed right after their control block in a single allocation.
+// MakeShared value-initialises the elements; the ForOverwrite variants
+// default-initialise them, so trivial element types are left unwritten.
+
+template <typename T, typename Policy = SingleThreadedPolicy>
+std::enable_if_t<std::is_array_v<T> && std::extent_v<T> == 0, SharedPtr<T, Policy>> MakeShared(size_t count) {
+    auto block = ControlBlockArray<std::remove_extent_t<T>, Policy>::Create(count, true);
+    return SharedPtr<T, Policy>(static_cast<IControlBlock<Policy>*>(block), block->GetRef());
+}
+
+template <typename T, typename Policy = SingleThreadedPolicy>
+std::enable_if_t<std::extent_v<T> != 0, SharedPtr<T, Policy>> MakeShared() {
+    auto block = ControlBlockArray<std::remove_extent_t<T>, Policy>::Create(std::extent_v<T>, true);
+    return SharedPtr<T, Policy>(static_cast<IControlBlock<Policy>*>(block), block->GetRef());
+}
+
+template <typename T, typename Policy = SingleThreadedPolicy>
+std::enable_if_t<!std::is_array_v<T>, SharedPtr<T, Policy>> MakeSharedForOverwrite() {
+    auto block = new ControlBlockDirect<T, Policy>(ForOverwriteTag());
+    return SharedPtr<T, Policy>(static_cast<IControlBlock<Policy>*>(block), block->GetRef());
+}
+
+template <typename T, typename Policy = SingleThreadedPolicy>
+std::enable_if_t<std::is_array_v<T> && std::extent_v<T> == 0, SharedPtr<T, Policy>> MakeSharedForOverwrite(
+    size_t count) {
+    auto block = ControlBlockArray<std::remove_extent_t<T>, Policy>::Create(count, false);
+    return SharedPtr<T, Policy>(static_cast<IControlBlock<Policy>*>(block), block->GetRef());
+}
+
+template <typename T, typename Policy = SingleThreadedPolicy>
+std::enable_if_t<std::extent_v<T> != 0, SharedPtr<T, Policy>> MakeSharedForOverwrite() {
+    auto block = ControlBlockArray<std::remove_extent_t<T>, Policy>::Create(std::extent_v<T>, false);
+    return SharedPtr<T, Policy>(static_cast<IControlBlock<Policy>*>(block), block->GetRef());
+}
+
+// Casts share ownership with the source through the aliasing constructors;
+// the rvalue overloads take over the source's reference instead of adding
+// one. A failed DynamicPointerCast returns null and leaves the source intact.
+
+template <typename T, typename U, typename Policy>
+SharedPtr<T, Policy> StaticPointerCast(const SharedPtr<U, Policy>& ptr) {
+    return SharedPtr<T, Policy>(ptr, static_cast<typename SharedPtr<T, Policy>::ElementType*>(ptr.Get()));
+}
+
+template <typename T, typename U, typename Policy>
+SharedPtr<T, Policy> StaticPointerCast(SharedPtr<U, Policy>&& ptr) {
+    auto raw = static_cast<typename SharedPtr<T, Policy>::ElementType*>(ptr.Get());
+    return SharedPtr<T, Policy>(std::move(ptr), raw);
+}
+
+template <typename T, typename U, typename Policy>
+SharedPtr<T, Policy> DynamicPointerCast(const SharedPtr<U, Policy>& ptr) {
+    if (auto raw = dynamic_cast<typename SharedPtr<T, Policy>::ElementType*>(ptr.Get())) {
+        return SharedPtr<T, Policy>(ptr, raw);
+    }
+    return SharedPtr<T, Policy>();
+}
+
+template <typename T, typename U, typename Policy>
+SharedPtr<T, Policy> DynamicPointerCast(SharedPtr<U, Policy>&& ptr) {
+    if (auto raw = dynamic_cast<typename SharedPtr<T, Policy>::ElementType*>(ptr.Get())) {
+        return SharedPtr<T, Policy>(std::move(ptr), raw);
+    }
+    return SharedPtr<T, Policy>();
+}
+
+template <typename T, typename U, typename Policy>
+SharedPtr<T, Policy> ConstPointerCast(const SharedPtr<U, Policy>& ptr) {
+    return SharedPtr<T, Policy>(ptr, const_cast<typename SharedPtr<T, Policy>::ElementType*>(ptr.Get()));
+}
+
+template <typename T, typename U, typename Policy>
+SharedPtr<T, Policy> ConstPointerCast(SharedPtr<U, Policy>&& ptr) {
+    auto raw = const_cast<typename SharedPtr<T, Policy>::ElementType*>(ptr.Get());
+    return SharedPtr<T, Policy>(std::move(ptr), raw);
+}
+
+template <typename T, typename U, typename Policy>
+SharedPtr<T, Policy> ReinterpretPointerCast(const SharedPtr<U, Policy>& ptr) {
+    return SharedPtr<T, Policy>(ptr, reinterpret_cast<typename SharedPtr<T, Policy>::ElementType*>(ptr.Get()));
+}
+
+template <typename T, typename U, typename Policy>
+SharedPtr<T, Policy> ReinterpretPointerCast(SharedPtr<U, Policy>&& ptr) {
+    auto raw = reinterpret_cast<typename SharedPtr<T, Policy>::ElementType*>(ptr.Get());
+    return SharedPtr<T, Policy>(std::move(ptr), raw);
 }
@@ -0,0 +1,153 @@
+#pragma once
+
+#include "thread_registry.h"
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+
+// Ownership statistics, compiled in only when SMART_POINTERS_STATS is defined.
+// Without it the hooks below compile to nothing. With it, count operations go
+// to per-thread counters that GetSnapshot() sums on demand; block creation and
+// release, already paid for by an allocation, update global live and peak
+// figures directly.
+#if defined(SMART_POINTERS_STATS)
+inline constexpr bool kStatsEnabled = true;
+#else
+inline constexpr bool kStatsEnabled = false;
+#endif
+
+enum class StatsOp {
+    kIncStrong,
+    kDecStrong,
+    kLock,
+    kIncWeak,
+    kDecWeak,
+    kCount,
+};
+
+enum class BlockKind {
+    kDirect,
+    kIndirect,
+    kArray,
+    kDirectAlloc,
+    kIndirectAlloc,
+    kDeferred,
+    kCount,
+};
+
+class OwnershipStats {
+public:
+    static constexpr size_t kOpCount = static_cast<size_t>(StatsOp::kCount);
+    static constexpr size_t kKindCount = static_cast<size_t>(BlockKind::kCount);
+
+    // bytes_held covers control block allocations, including objects and
+    // arrays stored inside them, but not objects adopted by pointer.
+    struct Snapshot {
+        size_t live_blocks = 0;
+        size_t peak_blocks = 0;
+        size_t bytes_held = 0;
+        size_t ops[kOpCount] = {};
+        size_t blocks_created[kKindCount] = {};
+    };
+
+    static void CountOp(StatsOp op) {
+        if constexpr (kStatsEnabled) {
+            Add(static_cast<size_t>(op));
+        }
+    }
+
+    static void BlockCreated(BlockKind kind, size_t bytes) {
+        if constexpr (kStatsEnabled) {
+            Add(kOpCount + static_cast<size_t>(kind));
+            Global& global = GetGlobal();
+            size_t live = global.live_blocks.fetch_add(1, std::memory_order_relaxed) + 1;
+            size_t peak = global.peak_blocks.load(std::memory_order_relaxed);
+            while (peak < live &&
+                   !global.peak_blocks.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+            }
+            global.bytes_held.fetch_add(bytes, std::memory_order_relaxed);
+        }
+    }
+
+    static void BlockFreed(size_t bytes) {
+        if constexpr (kStatsEnabled) {
+            Global& global = GetGlobal();
+            global.live_blocks.fetch_sub(1, std::memory_order_relaxed);
+            global.bytes_held.fetch_sub(bytes, std::memory_order_relaxed);
+        }
+    }
+
+    // All zero unless statistics are compiled in.
+    static Snapshot GetSnapshot() {
+        Snapshot snapshot;
+        if constexpr (kStatsEnabled) {
+            Global& global = GetGlobal();
+            size_t slots[kSlotCount];
+            {
+                std::lock_guard<std::mutex> lock(Registry::Mutex());
+                for (size_t slot = 0; slot < kSlotCount; ++slot) {
+                    slots[slot] = global.retired[slot];
+                }
+                Registry::ForEach([&slots](const ThreadCounters& counters) { counters.AddTo(slots); });
+            }
+            for (size_t op = 0; op < kOpCount; ++op) {
+                snapshot.ops[op] = slots[op];
+            }
+            for (size_t kind = 0; kind < kKindCount; ++kind) {
+                snapshot.blocks_created[kind] = slots[kOpCount + kind];
+            }
+            snapshot.live_blocks = global.live_blocks.load(std::memory_order_relaxed);
+            snapshot.peak_blocks = global.peak_blocks.load(std::memory_order_relaxed);
+            snapshot.bytes_held = global.bytes_held.load(std::memory_order_relaxed);
+        }
+        return snapshot;
+    }
+
+private:
+    // Op counts followed by blocks created per kind.
+    static constexpr size_t kSlotCount = kOpCount + kKindCount;
+
+    struct ThreadCounters;
+    using Registry = ThreadRegistry<ThreadCounters>;
+
+    // retired, the counts of exited threads, is guarded by Registry::Mutex().
+    struct Global {
+        size_t retired[kSlotCount] = {};
+        std::atomic<size_t> live_blocks{0};
+        std::atomic<size_t> peak_blocks{0};
+        std::atomic<size_t> bytes_held{0};
+    };
+
+    // Only the owning thread writes these; GetSnapshot reads them concurrently.
+    struct ThreadCounters {
+        std::atomic<size_t> slots[kSlotCount] = {};
+
+        void Retire() {
+            AddTo(GetGlobal().retired);
+        }
+
+        void AddTo(size_t* totals) const {
+            for (size_t slot = 0; slot < kSlotCount; ++slot) {
+                totals[slot] += slots[slot].load(std::memory_order_relaxed);
+            }
+        }
+    };
+
+    static void Add(size_t slot) {
+        ThreadCounters* counters = Registry::Local();
+        if (!counters) {
+            std::lock_guard<std::mutex> lock(Registry::Mutex());
+            ++GetGlobal().retired[slot];
+            return;
+        }
+        std::atomic<size_t>& counter = counters->slots[slot];
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    // Never destroyed, so blocks released during static destruction still count.
+    static Global& GetGlobal() {
+        static Global* global = new Global();
+        return *global;
+    }
+};
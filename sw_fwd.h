@@ -1,90 +1,339 @@
 #pragma once
 
+#include "compressed_pair.h"
+#include "pool.h"
+#include "profile.h"
+#include "stats.h"
+#include "teardown.h"
+#include "unique.h"  // Slug
+
+#include <atomic>
+#include <cstdint>
 #include <exception>
 #include <memory>
+#include <new>
+#include <typeinfo>
 
 class BadWeakPtr : public std::exception {};
 
-template <typename T>
+// Counting policies. A policy supplies the counter types the control block
+// keeps its strong and weak counts in; Decrement() reports whether the count
+// hit zero. A policy with kDeferredRelease may also discover a zero strong
+// count later and then calls ReleaseStrong() on the block it was bound to.
+
+class SingleThreadedPolicy {
+public:
+    static constexpr bool kDeferredRelease = false;
+
+    class Counter {
+    public:
+        explicit Counter(size_t value = 0) : value_(static_cast<uint32_t>(value)) {
+        }
+
+        void Increment() {
+            ++value_;
+        }
+
+        bool Decrement() {
+            return --value_ == 0;
+        }
+
+        bool IncrementIfNonZero() {
+            if (value_ == 0) {
+                return false;
+            }
+            ++value_;
+            return true;
+        }
+
+        size_t Load() const {
+            return value_;
+        }
+
+    private:
+        uint32_t value_;
+    };
+
+    using StrongCounter = Counter;
+    using WeakCounter = Counter;
+};
+
+class AtomicPolicy {
+public:
+    static constexpr bool kDeferredRelease = false;
+
+    class Counter {
+    public:
+        explicit Counter(size_t value = 0) : value_(static_cast<uint32_t>(value)) {
+        }
+
+        // A new reference is always made from an existing one, so there is
+        // nothing to order against.
+        void Increment() {
+            value_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // Release publishes our writes to the object; the acquire fence makes
+        // the thread that drops the last reference see all of them.
+        bool Decrement() {
+            if (value_.fetch_sub(1, std::memory_order_release) == 1) {
+                std::atomic_thread_fence(std::memory_order_acquire);
+                return true;
+            }
+            return false;
+        }
+
+        // Single CAS loop, so a count that reached zero is never revived.
+        bool IncrementIfNonZero() {
+            uint32_t value = value_.load(std::memory_order_relaxed);
+            do {
+                if (value == 0) {
+                    return false;
+                }
+            } while (!value_.compare_exchange_weak(value, value + 1, std::memory_order_acquire,
+                                                   std::memory_order_relaxed));
+            return true;
+        }
+
+        size_t Load() const {
+            return value_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        std::atomic<uint32_t> value_;
+    };
+
+    using StrongCounter = Counter;
+    using WeakCounter = Counter;
+};
+
+template <typename T, typename Policy = SingleThreadedPolicy>
 class SharedPtr;
 
-template <typename T>
+template <typename T, typename Policy = SingleThreadedPolicy>
 class WeakPtr;
 
+template <typename T, typename Policy = SingleThreadedPolicy>
+class CompactSharedPtr;
+
 class ESFTBase {};
 
+// kTypeInfo returns the type_info of the managed type; the others return null.
+enum class ControlOp {
+    kDestroy,
+    kDeallocate,
+    kTypeInfo,
+};
+
+// counter_total_ counts weak references plus one for the whole group of strong
+// references, so copying a SharedPtr touches a single counter.
+//
+// There is no vtable: each concrete block passes a manager function that
+// destroys its object, frees the block or names the type, so with 32-bit counts the header is
+// two counters and one function pointer.
+template <typename Policy>
 class IControlBlock {
 public:
+    friend Policy;
+
+    using Manager = const std::type_info* (*)(IControlBlock*, ControlOp);
+
+public:
+    explicit IControlBlock(Manager manager) : manager_(manager) {
+        if constexpr (Policy::kDeferredRelease) {
+            counter_strong_.Bind(this);
+        }
+    }
+
     void IncRefStrong() {
-        ++counter_strong_;
-        ++counter_total_;
+        Count(StatsOp::kIncStrong);
+        counter_strong_.Increment();
+    }
+    bool TryIncRefStrong() {
+        Count(StatsOp::kLock);
+        return counter_strong_.IncrementIfNonZero();
     }
     void DecRefStrong() {
-        --counter_strong_;
-        --counter_total_;
-        if (counter_strong_ == 0) {
-            Destroy();
+        Count(StatsOp::kDecStrong);
+        if (counter_strong_.Decrement()) {
+            ReleaseStrong();
         }
     }
 
+    void ReleaseStrong() {
+        Destroy();
+        DecRefWeak();
+    }
+
     void IncRefWeak() {
-        ++counter_total_;
+        Count(StatsOp::kIncWeak);
+        counter_total_.Increment();
     }
 
     void DecRefWeak() {
-        --counter_total_;
+        Count(StatsOp::kDecWeak);
+        if (counter_total_.Decrement()) {
+            Deallocate();
+        }
+    }
+
+    size_t RefCount() const {
+        return counter_strong_.Load();
     }
 
-    size_t RefCount() {
-        return counter_strong_;
+    size_t TotalCount() const {
+        return counter_total_.Load();
     }
 
-    size_t TotalCount() {
-        return counter_total_;
+    const std::type_info& TypeInfo() {
+        return *manager_(this, ControlOp::kTypeInfo);
     }
 
-    virtual ~IControlBlock() {
+    // True if this is exactly a Block, identified by its manager.
+    template <typename Block>
+    bool Is() const {
+        return manager_ == &Manage<Block>;
+    }
+
+protected:
+    ~IControlBlock() = default;
+
+    // Manager for a block type with non-virtual Destroy() and Deallocate().
+    template <typename Block>
+    static const std::type_info* Manage(IControlBlock* block, ControlOp op) {
+        Block* self = static_cast<Block*>(block);
+        switch (op) {
+            case ControlOp::kDestroy:
+                if constexpr (kIterativeTeardown<std::remove_pointer_t<decltype(self->GetRef())>>) {
+                    // The extra weak reference keeps the block alive if the
+                    // destruction is queued.
+                    block->IncRefWeak();
+                    Teardown::Run(block, &DestroyAndRelease<Block>);
+                } else {
+                    self->Destroy();
+                }
+                break;
+            case ControlOp::kDeallocate:
+                self->Deallocate();
+                break;
+            case ControlOp::kTypeInfo:
+                return &typeid(std::remove_pointer_t<decltype(self->GetRef())>);
+        }
+        return nullptr;
+    }
+
+    template <typename Block>
+    static void DestroyAndRelease(void* block) {
+        Block* self = static_cast<Block*>(static_cast<IControlBlock*>(block));
+        self->Destroy();
+        self->DecRefWeak();
     }
 
 private:
-    virtual void Destroy() = 0;
+    void Count(StatsOp op) {
+        OwnershipStats::CountOp(op);
+        ContentionProfiler::Sample(this);
+    }
+
+    void Destroy() {
+        manager_(this, ControlOp::kDestroy);
+    }
+
+    void Deallocate() {
+        manager_(this, ControlOp::kDeallocate);
+    }
 
 private:
-    size_t counter_strong_ = 0;
-    size_t counter_total_ = 0;
+    typename Policy::StrongCounter counter_strong_{0};
+    typename Policy::WeakCounter counter_total_{1};
+    Manager manager_;
 };
 
-template <typename T>
-class ControlBlockIndirect : public IControlBlock {
+static_assert(sizeof(IControlBlock<SingleThreadedPolicy>) == 16);
+static_assert(sizeof(IControlBlock<AtomicPolicy>) == 16);
+
+// The deleter shares a compressed_pair with the pointer, so the default and
+// any other stateless deleter cost no space.
+template <typename T, typename Policy = SingleThreadedPolicy, typename Deleter = Slug<T>>
+class ControlBlockIndirect : public IControlBlock<Policy> {
 public:
-    ControlBlockIndirect(T* ptr) : ptr_(ptr) {
+    friend IControlBlock<Policy>;
+
+    ControlBlockIndirect(T* ptr) : ControlBlockIndirect(ptr, Deleter()) {
+    }
+
+    ControlBlockIndirect(T* ptr, Deleter deleter)
+        : IControlBlock<Policy>(&IControlBlock<Policy>::template Manage<ControlBlockIndirect>),
+          value_(ptr, std::move(deleter)) {
+        OwnershipStats::BlockCreated(BlockKind::kIndirect, sizeof(ControlBlockIndirect));
+    }
+
+    // Adopting a raw pointer is common enough that these blocks come from the
+    // per-thread slab pool rather than malloc. The pool only aligns to
+    // BlockPool::kAlignment, so blocks over-aligned by their Policy, such as
+    // ShardedPolicy's cache-line shards, take the aligned overloads instead.
+    static void* operator new(size_t size) {
+        return BlockPool::Allocate(size);
+    }
+
+    static void operator delete(void* ptr, size_t size) {
+        BlockPool::Deallocate(ptr, size);
+    }
+
+    static void* operator new(size_t size, std::align_val_t alignment) {
+        return ::operator new(size, alignment);
+    }
+
+    static void operator delete(void* ptr, size_t size, std::align_val_t alignment) {
+        ::operator delete(ptr, size, alignment);
     }
 
     T* GetRef() {
-        return ptr_;
+        return value_.first();
     }
 
 private:
-    void Destroy() override {
-        if (ptr_) {
+    void Destroy() {
+        T*& ptr = value_.first();
+        if (ptr) {
             if constexpr (std::is_convertible_v<T*, ESFTBase*>) {
-                ptr_->ptr_.ForceDestruct();
+                ptr->ptr_.ForceDestruct();
             }
-            delete ptr_;
+            value_.second()(ptr);
         }
-        ptr_ = nullptr;
+        ptr = nullptr;
+    }
+
+    void Deallocate() {
+        OwnershipStats::BlockFreed(sizeof(ControlBlockIndirect));
+        delete this;
     }
 
 private:
-    T* ptr_;
+    compressed_pair<T*, Deleter> value_;
 };
 
-template <typename T>
-class ControlBlockDirect : public IControlBlock {
+static_assert(sizeof(ControlBlockIndirect<int>) == 24);
+
+// Selects default- instead of value-initialisation.
+struct ForOverwriteTag {};
+
+template <typename T, typename Policy = SingleThreadedPolicy>
+class ControlBlockDirect : public IControlBlock<Policy> {
 public:
+    friend IControlBlock<Policy>;
+
     template <typename... Args>
-    ControlBlockDirect(Args&&... args) {
+    ControlBlockDirect(Args&&... args)
+        : IControlBlock<Policy>(&IControlBlock<Policy>::template Manage<ControlBlockDirect>) {
         ::new (&data_) T(std::forward<Args>(args)...);
+        OwnershipStats::BlockCreated(BlockKind::kDirect, sizeof(ControlBlockDirect));
+    }
+
+    ControlBlockDirect(ForOverwriteTag)
+        : IControlBlock<Policy>(&IControlBlock<Policy>::template Manage<ControlBlockDirect>) {
+        ::new (&data_) T;
+        OwnershipStats::BlockCreated(BlockKind::kDirect, sizeof(ControlBlockDirect));
     }
 
     T* GetRef() {
@@ -92,46 +341,298 @@ public:
     }
 
 private:
-    void Destroy() override {
+    void Destroy() {
         if constexpr (std::is_convertible_v<T*, ESFTBase*>) {
             (reinterpret_cast<T*>(&data_))->ptr_.ForceDestruct();
         }
         std::destroy_at(std::launder(reinterpret_cast<T*>(&data_)));
     }
 
+    void Deallocate() {
+        OwnershipStats::BlockFreed(sizeof(ControlBlockDirect));
+        delete this;
+    }
+
 private:
     std::aligned_storage_t<sizeof(T), alignof(T)> data_;
 };
 
+// Block followed in the same allocation by count elements of T.
+template <typename T, typename Policy = SingleThreadedPolicy>
+class ControlBlockArray : public IControlBlock<Policy> {
+public:
+    friend IControlBlock<Policy>;
+
+    static ControlBlockArray* Create(size_t count, bool value_init) {
+        if (count > (SIZE_MAX - Offset()) / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        void* memory = ::operator new(AllocationSize(count), Alignment());
+        auto block = ::new (memory) ControlBlockArray(count);
+        T* elements = block->GetRef();
+        size_t constructed = 0;
+        try {
+            for (; constructed < count; ++constructed) {
+                if (value_init) {
+                    ::new (elements + constructed) T();
+                } else {
+                    ::new (elements + constructed) T;
+                }
+            }
+        } catch (...) {
+            block->DestroyElements(constructed);
+            block->Deallocate();
+            throw;
+        }
+        return block;
+    }
+
+    T* GetRef() {
+        return reinterpret_cast<T*>(reinterpret_cast<char*>(this) + Offset());
+    }
+
+private:
+    explicit ControlBlockArray(size_t count)
+        : IControlBlock<Policy>(&IControlBlock<Policy>::template Manage<ControlBlockArray>), count_(count) {
+        OwnershipStats::BlockCreated(BlockKind::kArray, AllocationSize(count));
+    }
+
+    static size_t AllocationSize(size_t count) {
+        return Offset() + count * sizeof(T);
+    }
+
+    void DestroyElements(size_t count) {
+        T* elements = GetRef();
+        while (count > 0) {
+            std::destroy_at(std::launder(elements + --count));
+        }
+    }
+
+    void Destroy() {
+        DestroyElements(count_);
+    }
+
+    void Deallocate() {
+        size_t size = AllocationSize(count_);
+        OwnershipStats::BlockFreed(size);
+        this->~ControlBlockArray();
+        ::operator delete(this, size, Alignment());
+    }
+
+    static constexpr size_t Offset() {
+        return (sizeof(ControlBlockArray) + alignof(T) - 1) / alignof(T) * alignof(T);
+    }
+
+    static constexpr std::align_val_t Alignment() {
+        return std::align_val_t(alignof(T) > alignof(ControlBlockArray) ? alignof(T) : alignof(ControlBlockArray));
+    }
+
+private:
+    size_t count_;
+};
+
+// Indirect block that owns a custom deleter and allocates itself from Alloc.
+// Both live in compressed_pairs, so stateless ones take no space.
+template <typename T, typename Deleter, typename Alloc, typename Policy = SingleThreadedPolicy>
+class ControlBlockIndirectAlloc : public IControlBlock<Policy> {
+public:
+    using BlockAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<ControlBlockIndirectAlloc>;
+    using BlockTraits = std::allocator_traits<BlockAlloc>;
+
+    friend IControlBlock<Policy>;
+
+    ControlBlockIndirectAlloc(T* ptr, Deleter deleter, const Alloc& alloc)
+        : IControlBlock<Policy>(&IControlBlock<Policy>::template Manage<ControlBlockIndirectAlloc>),
+          value_(compressed_pair<T*, Deleter>(ptr, std::move(deleter)), alloc) {
+        OwnershipStats::BlockCreated(BlockKind::kIndirectAlloc, sizeof(ControlBlockIndirectAlloc));
+    }
+
+    static ControlBlockIndirectAlloc* Create(T* ptr, Deleter deleter, const Alloc& alloc) {
+        BlockAlloc block_alloc(alloc);
+        auto block = BlockTraits::allocate(block_alloc, 1);
+        try {
+            ::new (block) ControlBlockIndirectAlloc(ptr, std::move(deleter), alloc);
+        } catch (...) {
+            BlockTraits::deallocate(block_alloc, block, 1);
+            throw;
+        }
+        return block;
+    }
+
+    T* GetRef() {
+        return value_.first().first();
+    }
+
+private:
+    void Destroy() {
+        T*& ptr = value_.first().first();
+        if (ptr) {
+            if constexpr (std::is_convertible_v<T*, ESFTBase*>) {
+                ptr->ptr_.ForceDestruct();
+            }
+            value_.first().second()(ptr);
+        }
+        ptr = nullptr;
+    }
+
+    void Deallocate() {
+        OwnershipStats::BlockFreed(sizeof(ControlBlockIndirectAlloc));
+        BlockAlloc block_alloc(value_.second());
+        this->~ControlBlockIndirectAlloc();
+        BlockTraits::deallocate(block_alloc, this, 1);
+    }
+
+private:
+    compressed_pair<compressed_pair<T*, Deleter>, Alloc> value_;
+};
+
+// Direct block placed by Alloc; the object is built and destroyed through the
+// allocator as well, as std::allocate_shared does.
+template <typename T, typename Alloc, typename Policy = SingleThreadedPolicy>
+class ControlBlockDirectAlloc : public IControlBlock<Policy> {
+public:
+    using BlockAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<ControlBlockDirectAlloc>;
+    using BlockTraits = std::allocator_traits<BlockAlloc>;
+    using ObjectAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<std::remove_cv_t<T>>;
+    using ObjectTraits = std::allocator_traits<ObjectAlloc>;
+    using Storage = std::aligned_storage_t<sizeof(T), alignof(T)>;
+
+    friend IControlBlock<Policy>;
+
+    template <typename... Args>
+    ControlBlockDirectAlloc(const Alloc& alloc, Args&&... args)
+        : IControlBlock<Policy>(&IControlBlock<Policy>::template Manage<ControlBlockDirectAlloc>),
+          alloc_(alloc, Empty()) {
+        ObjectAlloc object_alloc(alloc);
+        ObjectTraits::construct(object_alloc, GetObject(), std::forward<Args>(args)...);
+        OwnershipStats::BlockCreated(BlockKind::kDirectAlloc, sizeof(ControlBlockDirectAlloc));
+    }
+
+    template <typename... Args>
+    static ControlBlockDirectAlloc* Create(const Alloc& alloc, Args&&... args) {
+        BlockAlloc block_alloc(alloc);
+        auto block = BlockTraits::allocate(block_alloc, 1);
+        try {
+            ::new (block) ControlBlockDirectAlloc(alloc, std::forward<Args>(args)...);
+        } catch (...) {
+            BlockTraits::deallocate(block_alloc, block, 1);
+            throw;
+        }
+        return block;
+    }
+
+    T* GetRef() {
+        return reinterpret_cast<T*>(&storage_);
+    }
+
+private:
+    std::remove_cv_t<T>* GetObject() {
+        return std::launder(reinterpret_cast<std::remove_cv_t<T>*>(&storage_));
+    }
+
+    void Destroy() {
+        if constexpr (std::is_convertible_v<T*, ESFTBase*>) {
+            GetObject()->ptr_.ForceDestruct();
+        }
+        ObjectAlloc object_alloc(alloc_.first());
+        ObjectTraits::destroy(object_alloc, GetObject());
+    }
+
+    void Deallocate() {
+        OwnershipStats::BlockFreed(sizeof(ControlBlockDirectAlloc));
+        BlockAlloc block_alloc(alloc_.first());
+        this->~ControlBlockDirectAlloc();
+        BlockTraits::deallocate(block_alloc, this, 1);
+    }
+
+private:
+    struct Empty {};
+
+    // Left uninitialised: the object is constructed in it through Alloc.
+    Storage storage_;
+    compressed_pair<Alloc, Empty> alloc_;
+};
+
+// Direct block that calls hook() after destroying the object, i.e. when the
+// strong count reaches zero. The hook sits in a compressed_pair, so a
+// stateless one adds at most a byte.
+template <typename T, typename Hook, typename Policy = SingleThreadedPolicy>
+class ControlBlockExpiry : public IControlBlock<Policy> {
+public:
+    using Storage = std::aligned_storage_t<sizeof(T), alignof(T)>;
+
+    friend IControlBlock<Policy>;
+
+    template <typename... Args>
+    ControlBlockExpiry(Hook hook, Args&&... args)
+        : IControlBlock<Policy>(&IControlBlock<Policy>::template Manage<ControlBlockExpiry>),
+          hook_(std::move(hook), Empty()) {
+        ::new (&storage_) T(std::forward<Args>(args)...);
+        OwnershipStats::BlockCreated(BlockKind::kDirect, sizeof(ControlBlockExpiry));
+    }
+
+    T* GetRef() {
+        return reinterpret_cast<T*>(&storage_);
+    }
+
+private:
+    void Destroy() {
+        if constexpr (std::is_convertible_v<T*, ESFTBase*>) {
+            GetRef()->ptr_.ForceDestruct();
+        }
+        std::destroy_at(std::launder(GetRef()));
+        hook_.first()();
+    }
+
+    void Deallocate() {
+        OwnershipStats::BlockFreed(sizeof(ControlBlockExpiry));
+        delete this;
+    }
+
+private:
+    struct Empty {};
+
+    // Left uninitialised until the constructor builds T in it.
+    Storage storage_;
+    compressed_pair<Hook, Empty> hook_;
+};
 
-template <typename T>
+template <typename T, typename Policy = SingleThreadedPolicy>
 class EnableSharedFromThis : public ESFTBase {
 public:
-    template <typename U>
+    template <typename U, typename P>
     friend class SharedPtr;
-    template <typename U>
+    template <typename U, typename P>
     friend class WeakPtr;
 
-    template <typename U>
+    template <typename U, typename P>
     friend class ControlBlockDirect;
-    template <typename U>
+    template <typename U, typename P, typename D>
     friend class ControlBlockIndirect;
+    template <typename U, typename D, typename A, typename P>
+    friend class ControlBlockIndirectAlloc;
+    template <typename U, typename A, typename P>
+    friend class ControlBlockDirectAlloc;
+    template <typename U, typename P>
+    friend class ControlBlockDeferred;
+    template <typename U, typename H, typename P>
+    friend class ControlBlockExpiry;
 
 public:
-    SharedPtr<T> SharedFromThis() {
-        return SharedPtr<T>(ptr_);
+    SharedPtr<T, Policy> SharedFromThis() {
+        return SharedPtr<T, Policy>(ptr_);
     }
-    SharedPtr<const T> SharedFromThis() const {
-        return SharedPtr<const T>(ptr_);
+    SharedPtr<const T, Policy> SharedFromThis() const {
+        return SharedPtr<const T, Policy>(ptr_);
     }
 
-    WeakPtr<T> WeakFromThis() noexcept {
-        return WeakPtr<T>(ptr_);
+    WeakPtr<T, Policy> WeakFromThis() noexcept {
+        return WeakPtr<T, Policy>(ptr_);
     }
-    WeakPtr<const T> WeakFromThis() const noexcept {
-        return WeakPtr<const T>(ptr_);
+    WeakPtr<const T, Policy> WeakFromThis() const noexcept {
+        return WeakPtr<const T, Policy>(ptr_);
     }
 
 private:
-    WeakPtr<T> ptr_;
+    WeakPtr<T, Policy> ptr_;
 };
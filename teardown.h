@@ -0,0 +1,67 @@
+#pragma once
+
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// Iterative destruction for linked structures. Destroying the head of a long
+// SharedPtr or UniquePtr chain normally recurses once per node. For types that
+// opt in, a destruction that starts while another is already running on the
+// same thread is queued instead, and the outermost one drains the queue in a
+// loop, so the stack depth stays constant however long the chain is.
+//
+// Opt in by deriving from IterativeTeardownBase or specialising
+// IterativeTeardown<T>. UniquePtr takes part only with a stateless deleter.
+class IterativeTeardownBase {};
+
+template <typename T>
+struct IterativeTeardown : std::is_convertible<T*, IterativeTeardownBase*> {};
+
+template <typename T>
+inline constexpr bool kIterativeTeardown = IterativeTeardown<std::remove_cv_t<T>>::value;
+
+class Teardown {
+public:
+    using Destroyer = void (*)(void*);
+
+    // Runs destroy(object) now, or queues it if this thread is already
+    // tearing something down.
+    static void Run(void* object, Destroyer destroy) {
+        State& state = GetState();
+        if (state.running) {
+            try {
+                state.pending.push_back({object, destroy});
+                return;
+            } catch (const std::bad_alloc&) {
+                // Out of memory for the queue: fall back to recursing.
+            }
+            destroy(object);
+            return;
+        }
+
+        state.running = true;
+        destroy(object);
+        while (!state.pending.empty()) {
+            Entry entry = state.pending.back();
+            state.pending.pop_back();
+            entry.destroy(entry.object);
+        }
+        state.running = false;
+    }
+
+private:
+    struct Entry {
+        void* object;
+        Destroyer destroy;
+    };
+
+    struct State {
+        bool running = false;
+        std::vector<Entry> pending;
+    };
+
+    static State& GetState() {
+        thread_local State state;
+        return state;
+    }
+};
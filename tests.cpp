@@ -0,0 +1,537 @@
+// Regression checks for cases that the benchmark exercises but does not
+// verify. There is no build target; compile and run it directly, e.g.
+//
+//     g++ -std=c++17 -g -fsanitize=address,undefined -pthread tests.cpp -o tests && ./tests
+//
+// Exits non-zero and names the failed checks if any fail.
+
+#include "arena.h"
+#include "atomic_shared.h"
+#include "biased.h"
+#include "relocate.h"
+#include "shared.h"
+#include "sharded.h"
+#include "teardown.h"
+#include "unique.h"
+#include "weak.h"
+#include "weak_cache.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(condition)                                                         \
+    do {                                                                         \
+        if (!(condition)) {                                                      \
+            std::fprintf(stderr, "%s:%d: CHECK(%s)\n", __FILE__, __LINE__, #condition); \
+            ++failures;                                                          \
+        }                                                                        \
+    } while (false)
+
+bool InChunk(const void* ptr, size_t size, const void* chunk_start, size_t chunk_size) {
+    auto address = reinterpret_cast<uintptr_t>(ptr);
+    auto start = reinterpret_cast<uintptr_t>(chunk_start);
+    return address >= start && address + size <= start + chunk_size;
+}
+
+// Alignment padding that runs past the end of the chunk must move the
+// allocation to a new chunk, not hand out memory beyond the old one.
+void TestArenaPaddingOverflow() {
+    Arena arena(100);
+    void* first = arena.Allocate(96, 1);
+    void* second = arena.Allocate(1, 64);
+    CHECK(reinterpret_cast<uintptr_t>(second) % 64 == 0);
+    CHECK(!InChunk(second, 1, first, 100));
+    *static_cast<char*>(second) = 1;
+
+    arena.Reset();
+    CHECK(arena.Allocate(96, 1) == first);
+}
+
+// Array lengths whose byte size overflows must be rejected before anything
+// is allocated or constructed.
+void TestSharedArrayLengthOverflow() {
+    bool thrown = false;
+    try {
+        MakeShared<int[]>(SIZE_MAX / 4 + 2);
+    } catch (const std::bad_array_new_length&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+
+void TestPooledArrayLengthOverflow() {
+    bool thrown = false;
+    try {
+        MakeUnique<int[]>(SIZE_MAX / 4 + 2);
+    } catch (const std::bad_array_new_length&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+
+    thrown = false;
+    try {
+        MakeUniqueForOverwrite<int[]>(SIZE_MAX / 4 + 2);
+    } catch (const std::bad_array_new_length&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+
+// Appending an element of the vector itself when it is full must copy the
+// element before the old buffer goes away.
+void TestRelocatingVectorSelfAppend() {
+    RelocatingVector<std::string> strings;
+    strings.PushBack(std::string(64, 'a'));
+    while (strings.Size() < strings.Capacity()) {
+        strings.PushBack(std::string(64, 'b'));
+    }
+    strings.PushBack(strings[0]);
+    CHECK(strings[strings.Size() - 1] == std::string(64, 'a'));
+}
+
+// ShardedPolicy blocks are over-aligned and must not come from the 16-byte
+// aligned pool.
+void TestOverAlignedIndirectBlocks() {
+    std::vector<SharedPtr<int, ShardedPolicy>> pointers;
+    for (int i = 0; i < 100; ++i) {
+        pointers.emplace_back(new int(i));
+    }
+    for (const SharedPtr<int, ShardedPolicy>& ptr : pointers) {
+        CHECK(reinterpret_cast<uintptr_t>(ptr.OwnerId()) % alignof(ControlBlockIndirect<int, ShardedPolicy>) == 0);
+        KillSharded(ptr);
+    }
+}
+
+// AllocateShared must construct the object straight in the block: no
+// zeroed temporary of sizeof(T) on the stack and no copy of one.
+
+constexpr unsigned char kFillByte = 0xAB;
+
+// Hides where ptr came from. The fill happens before the control block's
+// lifetime starts, so the optimiser may otherwise drop it as a dead store
+// or treat the object's bytes as undefined.
+template <typename T>
+T* Opaque(T* ptr) {
+#if defined(__GNUC__)
+    asm volatile("" : "+r"(ptr) : : "memory");
+#endif
+    return ptr;
+}
+
+template <typename T>
+class FillingAllocator {
+public:
+    using value_type = T;
+
+    FillingAllocator() {
+    }
+
+    template <typename U>
+    FillingAllocator(const FillingAllocator<U>&) {
+    }
+
+    T* allocate(size_t count) {
+        void* memory = ::operator new(count * sizeof(T));
+        std::memset(memory, kFillByte, count * sizeof(T));
+        return static_cast<T*>(Opaque(memory));
+    }
+
+    void deallocate(T* ptr, size_t) {
+        ::operator delete(ptr);
+    }
+
+    // Default-initialises, so a trivial U is left as allocated.
+    template <typename U, typename... Args>
+    void construct(U* ptr, Args&&... args) {
+        if constexpr (sizeof...(Args) == 0) {
+            ::new (static_cast<void*>(ptr)) U;
+        } else {
+            ::new (static_cast<void*>(ptr)) U(std::forward<Args>(args)...);
+        }
+    }
+
+    template <typename U>
+    bool operator==(const FillingAllocator<U>&) const {
+        return true;
+    }
+    template <typename U>
+    bool operator!=(const FillingAllocator<U>&) const {
+        return false;
+    }
+};
+
+template <size_t Size>
+struct RawBytes {
+    unsigned char bytes[Size];
+};
+
+template <size_t Size>
+bool AllFilled(const RawBytes<Size>& raw) {
+    for (unsigned char byte : Opaque(&raw)->bytes) {
+        if (byte != kFillByte) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void TestAllocateSharedLeavesBytes() {
+    SharedPtr<RawBytes<64>> small = AllocateShared<RawBytes<64>>(FillingAllocator<RawBytes<64>>());
+    CHECK(AllFilled(*small));
+
+    // Larger than the default 8 MiB stack.
+    using Large = RawBytes<32 * 1024 * 1024>;
+    SharedPtr<Large> large = AllocateShared<Large>(FillingAllocator<Large>());
+    CHECK(AllFilled(*large));
+}
+
+// A value whose constructor throws must leave no entry behind in a
+// WeakValueCache.
+
+struct ThrowingValue {
+    explicit ThrowingValue(bool fail) {
+        if (fail) {
+            throw std::runtime_error("construction failed");
+        }
+    }
+};
+
+void TestWeakCacheThrowingConstructor() {
+    WeakValueCache<int, ThrowingValue> cache;
+    bool thrown = false;
+    try {
+        cache.GetOrCreate(1, true);
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+    CHECK(cache.Size() == 0);
+
+    SharedPtr<ThrowingValue, AtomicPolicy> value = cache.GetOrCreate(1, false);
+    CHECK(cache.Get(1) == value);
+    CHECK(cache.Size() == 1);
+}
+
+// AtomicSharedPtr must hand out valid values under concurrent use and free
+// every value and node once they are dropped, including after readers push
+// a node's 16-bit external count past the transfer threshold.
+
+std::atomic<int> live_objects{0};
+
+struct Tracked {
+    static constexpr int kMagic = 0x5EED;
+
+    explicit Tracked(int id) : id(id) {
+        live_objects.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    ~Tracked() {
+        magic = 0;
+        live_objects.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    int id;
+    int magic = kMagic;
+};
+
+using TrackedPtr = SharedPtr<Tracked, AtomicPolicy>;
+
+// Well past 2^14, and past 2^16, where an external count that was never
+// transferred would wrap.
+constexpr int kManyLoads = 100000;
+
+void TestAtomicSharedPtrTransfer() {
+    {
+        AtomicSharedPtr<Tracked> atomic(MakeShared<Tracked, AtomicPolicy>(1));
+        bool all_valid = true;
+        for (int i = 0; i < kManyLoads; ++i) {
+            TrackedPtr value = atomic.Load();
+            all_valid = all_valid && value && value->id == 1 && value->magic == Tracked::kMagic;
+        }
+        CHECK(all_valid);
+        CHECK(atomic.Load().UseCount() == 2);
+        CHECK(live_objects.load() == 1);
+
+        atomic.Store(MakeShared<Tracked, AtomicPolicy>(2));
+        CHECK(live_objects.load() == 1);
+        CHECK(atomic.Load()->id == 2);
+    }
+    CHECK(live_objects.load() == 0);
+}
+
+void TestAtomicSharedPtrConcurrent() {
+    constexpr int kThreads = 4;
+    constexpr int kIterations = 50000;
+    std::atomic<bool> all_valid{true};
+    {
+        AtomicSharedPtr<Tracked> atomic(MakeShared<Tracked, AtomicPolicy>(0));
+        auto check = [&all_valid](const TrackedPtr& value) {
+            if (value && value->magic != Tracked::kMagic) {
+                all_valid.store(false, std::memory_order_relaxed);
+            }
+        };
+        std::vector<std::thread> threads;
+        for (int t = 0; t < kThreads; ++t) {
+            threads.emplace_back([&atomic, &check, t] {
+                for (int i = 0; i < kIterations; ++i) {
+                    switch ((t + i) % 4) {
+                        case 0:
+                            check(atomic.Load());
+                            break;
+                        case 1:
+                            atomic.Store(i % 16 ? MakeShared<Tracked, AtomicPolicy>(i) : TrackedPtr());
+                            break;
+                        case 2:
+                            check(atomic.Exchange(MakeShared<Tracked, AtomicPolicy>(i)));
+                            break;
+                        case 3: {
+                            TrackedPtr expected = atomic.Load();
+                            check(expected);
+                            if (!atomic.CompareExchange(expected, MakeShared<Tracked, AtomicPolicy>(i))) {
+                                check(expected);
+                            }
+                            break;
+                        }
+                    }
+                }
+            });
+        }
+        // A reader that only loads keeps each stored value's external count
+        // climbing towards the threshold.
+        threads.emplace_back([&atomic, &check] {
+            for (int i = 0; i < kManyLoads; ++i) {
+                check(atomic.Load());
+            }
+        });
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+    CHECK(all_valid.load());
+    CHECK(live_objects.load() == 0);
+}
+
+// Biased counting: a last release off the owner thread is queued, and the
+// object must go once the owner merges, whether through MergePending or at
+// thread exit, and never while a WeakPtr can still lock it.
+
+using BiasedTrackedPtr = SharedPtr<Tracked, BiasedPolicy>;
+
+void TestBiasedReleaseOffOwner() {
+    BiasedTrackedPtr ptr = MakeSharedBiased<Tracked>(1);
+    WeakPtr<Tracked, BiasedPolicy> weak(ptr);
+    std::thread([ptr = std::move(ptr)]() mutable { ptr.Reset(); }).join();
+    CHECK(live_objects.load() == 1);
+
+    BiasedPolicy::MergePending();
+    CHECK(live_objects.load() == 0);
+    CHECK(weak.Expired());
+}
+
+void TestBiasedMergeAtOwnerExit() {
+    WeakPtr<Tracked, BiasedPolicy> weak;
+    std::thread([&weak] {
+        BiasedTrackedPtr ptr = MakeSharedBiased<Tracked>(1);
+        weak = ptr;
+        std::thread([ptr = std::move(ptr)]() mutable { ptr.Reset(); }).join();
+    }).join();
+    CHECK(live_objects.load() == 0);
+    CHECK(weak.Expired());
+
+    // The owner is gone before the release, so it is merged in place.
+    BiasedTrackedPtr ptr;
+    std::thread([&ptr] { ptr = MakeSharedBiased<Tracked>(2); }).join();
+    ptr.Reset();
+    CHECK(live_objects.load() == 0);
+}
+
+void TestBiasedWeakLockRace() {
+    constexpr int kTrials = 200;
+    bool all_valid = true;
+    bool all_expired = true;
+    for (int trial = 0; trial < kTrials; ++trial) {
+        BiasedTrackedPtr ptr = MakeSharedBiased<Tracked>(trial);
+        WeakPtr<Tracked, BiasedPolicy> weak(ptr);
+        std::atomic<bool> valid{true};
+        std::thread releaser([ptr = std::move(ptr)]() mutable { ptr.Reset(); });
+        std::thread locker([&weak, &valid] {
+            for (int i = 0; i < 100; ++i) {
+                BiasedTrackedPtr locked = weak.Lock();
+                if (locked && locked->magic != Tracked::kMagic) {
+                    valid.store(false, std::memory_order_relaxed);
+                }
+            }
+        });
+        releaser.join();
+        locker.join();
+        BiasedPolicy::MergePending();
+        all_valid = all_valid && valid.load();
+        all_expired = all_expired && weak.Expired();
+    }
+    CHECK(all_valid);
+    CHECK(all_expired);
+    CHECK(live_objects.load() == 0);
+}
+
+// Sharded counting: copies on many threads keep the object alive until it
+// is killed, and the last release after the kill frees it.
+
+using ShardedTrackedPtr = SharedPtr<Tracked, ShardedPolicy>;
+
+void ChurnCopies(const ShardedTrackedPtr& ptr, int copies) {
+    std::vector<ShardedTrackedPtr> held;
+    for (int i = 0; i < copies; ++i) {
+        held.push_back(ptr);
+        if (held.size() == 16) {
+            held.clear();
+        }
+    }
+}
+
+void TestShardedKill() {
+    constexpr int kThreads = 4;
+    constexpr int kCopies = 20000;
+    ShardedTrackedPtr ptr = MakeSharedSharded<Tracked>(1);
+    WeakPtr<Tracked, ShardedPolicy> weak(ptr);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&ptr] { ChurnCopies(ptr, kCopies); });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    CHECK(ptr.UseCount() >= 1);
+    CHECK(live_objects.load() == 1);
+
+    // Kill while other threads still copy and drop their own references.
+    threads.clear();
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([copy = ptr] { ChurnCopies(copy, kCopies); });
+    }
+    KillSharded(ptr);
+    ptr.Reset();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    CHECK(live_objects.load() == 0);
+    CHECK(weak.Expired());
+}
+
+// Tearing down multi-million-node chains and trees must run every
+// destructor without recursing once per node, which would overflow the
+// stack long before the end.
+
+constexpr size_t kChainLength = 3000000;
+constexpr size_t kTreeDepth = 21;
+
+size_t destroyed_nodes = 0;
+
+struct SharedChainNode : IterativeTeardownBase {
+    SharedPtr<SharedChainNode> next;
+
+    ~SharedChainNode() {
+        ++destroyed_nodes;
+    }
+};
+
+struct UniqueChainNode : IterativeTeardownBase {
+    UniquePtr<UniqueChainNode> next;
+
+    ~UniqueChainNode() {
+        ++destroyed_nodes;
+    }
+};
+
+struct TreeNode : IterativeTeardownBase {
+    SharedPtr<TreeNode> left;
+    SharedPtr<TreeNode> right;
+
+    ~TreeNode() {
+        ++destroyed_nodes;
+    }
+};
+
+SharedPtr<TreeNode> BuildTree(size_t depth) {
+    if (depth == 0) {
+        return SharedPtr<TreeNode>();
+    }
+    SharedPtr<TreeNode> node = MakeShared<TreeNode>();
+    node->left = BuildTree(depth - 1);
+    node->right = BuildTree(depth - 1);
+    return node;
+}
+
+void TestSharedChainTeardown() {
+    SharedPtr<SharedChainNode> head;
+    for (size_t i = 0; i < kChainLength; ++i) {
+        SharedPtr<SharedChainNode> node = MakeShared<SharedChainNode>();
+        node->next = std::move(head);
+        head = std::move(node);
+    }
+    WeakPtr<SharedChainNode> weak_head(head);
+    destroyed_nodes = 0;
+    head.Reset();
+    CHECK(destroyed_nodes == kChainLength);
+    CHECK(weak_head.Expired());
+}
+
+void TestUniqueChainTeardown() {
+    UniquePtr<UniqueChainNode> head;
+    for (size_t i = 0; i < kChainLength; ++i) {
+        UniquePtr<UniqueChainNode> node(new UniqueChainNode());
+        node->next = std::move(head);
+        head = std::move(node);
+    }
+    destroyed_nodes = 0;
+    head.Reset();
+    CHECK(destroyed_nodes == kChainLength);
+}
+
+void TestTreeTeardown() {
+    SharedPtr<TreeNode> root = BuildTree(kTreeDepth);
+    WeakPtr<TreeNode> weak_root(root);
+    destroyed_nodes = 0;
+    root.Reset();
+    CHECK(destroyed_nodes == (size_t(1) << kTreeDepth) - 1);
+    CHECK(weak_root.Expired());
+}
+
+}  // namespace
+
+int main() {
+    TestArenaPaddingOverflow();
+    TestSharedArrayLengthOverflow();
+    TestPooledArrayLengthOverflow();
+    TestRelocatingVectorSelfAppend();
+    TestOverAlignedIndirectBlocks();
+    TestAllocateSharedLeavesBytes();
+    TestWeakCacheThrowingConstructor();
+    TestAtomicSharedPtrTransfer();
+    TestAtomicSharedPtrConcurrent();
+    TestBiasedReleaseOffOwner();
+    TestBiasedMergeAtOwnerExit();
+    TestBiasedWeakLockRace();
+    TestShardedKill();
+    TestSharedChainTeardown();
+    TestUniqueChainTeardown();
+    TestTreeTeardown();
+
+    if (failures) {
+        std::fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    std::printf("all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <mutex>
+
+// One Node per thread, created on the thread's first Local() call and listed
+// so that other threads can visit every live one, e.g. to sum per-thread
+// counters. At thread exit node.Retire() runs under Mutex(), so that it can
+// fold the node's figures into totals that readers also take under Mutex(),
+// and the node is unlinked; its destructor runs after that. From then on
+// Local() returns null on that thread.
+//
+// The registry is never destroyed, so Local() and Mutex() stay usable during
+// static destruction.
+template <typename Node>
+class ThreadRegistry {
+public:
+    // Null once the calling thread's node has been torn down.
+    static Node* Local() {
+        State& state = GetState();
+        if (!state.node && !state.exited) {
+            thread_local Holder holder;
+            state.node = &holder.node;
+        }
+        return state.node;
+    }
+
+    static std::mutex& Mutex() {
+        return GetGlobal().mutex;
+    }
+
+    // Calls f(node) for every live node. The caller must hold Mutex().
+    template <typename F>
+    static void ForEach(F&& f) {
+        for (Holder* holder = GetGlobal().holders; holder; holder = holder->next) {
+            f(holder->node);
+        }
+    }
+
+private:
+    struct Holder {
+        Node node;
+        Holder* next = nullptr;
+        Holder* prev = nullptr;
+
+        Holder() {
+            Global& global = GetGlobal();
+            std::lock_guard<std::mutex> lock(global.mutex);
+            next = global.holders;
+            if (next) {
+                next->prev = this;
+            }
+            global.holders = this;
+        }
+
+        ~Holder() {
+            Global& global = GetGlobal();
+            {
+                std::lock_guard<std::mutex> lock(global.mutex);
+                node.Retire();
+                (prev ? prev->next : global.holders) = next;
+                if (next) {
+                    next->prev = prev;
+                }
+            }
+            GetState().node = nullptr;
+            GetState().exited = true;
+        }
+    };
+
+    struct Global {
+        std::mutex mutex;
+        Holder* holders = nullptr;
+    };
+
+    struct State {
+        Node* node = nullptr;
+        bool exited = false;
+    };
+
+    static Global& GetGlobal() {
+        static Global* global = new Global();
+        return *global;
+    }
+
+    static State& GetState() {
+        thread_local State state;
+        return state;
+    }
+};
@@ -1,9 +1,16 @@
 #pragma once
 
 #include "compressed_pair.h"
+#include "pool.h"
+#include "relocate.h"
+#include "teardown.h"
 
 #include <cstddef>  // std::nullptr_t
+#include <cstdint>
+#include <memory>
+#include <new>
 #include <type_traits>
+#include <utility>
 
 template <class U>
 struct Slug {
@@ -45,6 +52,8 @@ public:
     template <typename Q, typename V>
     friend class UniquePtr;
 
+    using TriviallyRelocatable = std::bool_constant<kTriviallyRelocatable<Deleter>>;
+
 public:
 
     explicit UniquePtr(T* ptr = nullptr) : value_(ptr, Deleter()) {
@@ -57,16 +66,16 @@ public:
     UniquePtr(const UniquePtr& other) = delete;
 
     template <typename V, typename Q>
-    UniquePtr(UniquePtr<V, Q>&& other) noexcept : value_(other.Get(), other.GetDeleter()) {
-        other.Get() = nullptr;
+    UniquePtr(UniquePtr<V, Q>&& other) noexcept : value_(other.Get(), std::move(other.GetDeleter())) {
+        other.value_.first() = nullptr;
     }
 
     UniquePtr& operator=(UniquePtr&& other) noexcept {
         if (this != &other) {
             Clear();
-            Get() = std::move(other.Get());
+            value_.first() = other.value_.first();
             GetDeleter() = std::move(other.GetDeleter());
-            other.Get() = nullptr;
+            other.value_.first() = nullptr;
         }
         return *this;
     }
@@ -75,9 +84,9 @@ public:
     template <typename V, typename Q>
     UniquePtr& operator=(UniquePtr<V, Q>&& other) noexcept {
         Clear();
-        Get() = std::move(other.Get());
+        value_.first() = other.value_.first();
         GetDeleter() = std::move(other.GetDeleter());
-        other.Get() = nullptr;
+        other.value_.first() = nullptr;
         return *this;
     }
 
@@ -92,18 +101,24 @@ public:
 
     T* Release() {
         T* ptr = Get();
-        Get() = nullptr;
+        value_.first() = nullptr;
         return ptr;
     }
     void Reset(T* ptr = nullptr) {
         T* old_ptr = Get();
-        Get() = ptr;
-        GetDeleter()(old_ptr);
+        value_.first() = ptr;
+        if (old_ptr) {
+            Delete(old_ptr);
+        }
     }
-    void Swap(UniquePtr& other) {
+    void Swap(UniquePtr& other) noexcept {
         std::swap(value_, other.value_);
     }
 
+    friend void swap(UniquePtr& left, UniquePtr& right) noexcept {
+        left.Swap(right);
+    }
+
     T* Get() const {
         return value_.first();
     }
@@ -120,18 +135,29 @@ public:
 
 private:  
     void Clear() {
-        auto& ptr = Get();
+        T*& ptr = value_.first();
         if (ptr != nullptr) {
-            GetDeleter()(ptr);
+            Delete(ptr);
             ptr = nullptr;
         }
     }
 
+    void Delete(T* ptr) {
+        if constexpr (kIterativeTeardown<T> && std::is_empty_v<Deleter> &&
+                      std::is_default_constructible_v<Deleter>) {
+            Teardown::Run(const_cast<std::remove_cv_t<T>*>(ptr), [](void* object) {
+                Deleter()(static_cast<T*>(object));
+            });
+        } else {
+            GetDeleter()(ptr);
+        }
+    }
+
     Deleter& GetDeleter() {
-        return value_.GetSecond();
+        return value_.second();
     }
     const Deleter& GetDeleter() const {
-        return value_.GetSecond();
+        return value_.second();
     }
 
 private:
@@ -144,6 +170,8 @@ public:
     template <typename Q, typename V>
     friend class UniquePtr;
 
+    using TriviallyRelocatable = std::bool_constant<kTriviallyRelocatable<Deleter>>;
+
 public:
 
     explicit UniquePtr(T* ptr = nullptr) : value_(ptr, Deleter()) {
@@ -156,16 +184,16 @@ public:
     UniquePtr(const UniquePtr& other) = delete;
 
     template <typename V, typename Q>
-    UniquePtr(UniquePtr<V, Q>&& other) noexcept : value_(other.Get(), other.GetDeleter()) {
-        other.Get() = nullptr;
+    UniquePtr(UniquePtr<V, Q>&& other) noexcept : value_(other.Get(), std::move(other.GetDeleter())) {
+        other.value_.first() = nullptr;
     }
 
     UniquePtr& operator=(UniquePtr&& other) noexcept {
         if (this != &other) {
             Clear();
-            Get() = std::move(other.Get());
+            value_.first() = other.value_.first();
             GetDeleter() = std::move(other.GetDeleter());
-            other.Get() = nullptr;
+            other.value_.first() = nullptr;
         }
         return *this;
     }
@@ -174,9 +202,9 @@ public:
     template <typename V, typename Q>
     UniquePtr& operator=(UniquePtr<V, Q>&& other) noexcept {
         Clear();
-        Get() = std::move(other.Get());
+        value_.first() = other.value_.first();
         GetDeleter() = std::move(other.GetDeleter());
-        other.Get() = nullptr;
+        other.value_.first() = nullptr;
         return *this;
     }
 
@@ -191,18 +219,24 @@ public:
 
     T* Release() {
         T* ptr = Get();
-        Get() = nullptr;
+        value_.first() = nullptr;
         return ptr;
     }
     void Reset(T* ptr = nullptr) {
         T* old_ptr = Get();
-        Get() = ptr;
-        GetDeleter()(old_ptr);
+        value_.first() = ptr;
+        if (old_ptr) {
+            GetDeleter()(old_ptr);
+        }
     }
-    void Swap(UniquePtr& other) {
+    void Swap(UniquePtr& other) noexcept {
         std::swap(value_, other.value_);
     }
 
+    friend void swap(UniquePtr& left, UniquePtr& right) noexcept {
+        left.Swap(right);
+    }
+
     T* Get() const {
         return value_.first();
     }
@@ -223,7 +257,7 @@ public:
 
 private:  
     void Clear() {
-        auto& ptr = Get();
+        T*& ptr = value_.first();
         if (ptr != nullptr) {
             GetDeleter()(ptr);
             ptr = nullptr;
@@ -231,14 +265,145 @@ private:
     }
 
     Deleter& GetDeleter() {
-        return value_.GetSecond();
+        return value_.second();
     }
     const Deleter& GetDeleter() const {
-        return value_.GetSecond();
+        return value_.second();
     }
 
 private:
     compressed_pair<T*, Deleter> value_;
 };
 
-     
\ No newline at end of file
+     
+// Deleter for objects made by MakeUnique: destroys the object and returns its
+// memory to BlockPool, whose per-thread free lists take blocks freed on any
+// thread. It is stateless, so a pooled UniquePtr is one word. A PoolDeleter<U>
+// converts to PoolDeleter<T> only when both sizes share a size class, which
+// keeps UniquePtr<Derived> to UniquePtr<Base> conversions safe.
+template <typename T>
+struct PoolDeleter {
+    PoolDeleter() {
+    }
+
+    template <typename U>
+    PoolDeleter(const PoolDeleter<U>&) {
+        static_assert(BlockPool::SameClass(sizeof(U), sizeof(T)), "freed with a different size class");
+    }
+
+    void operator()(T* ptr) const {
+        void* memory;
+        if constexpr (std::is_polymorphic_v<T>) {
+            memory = dynamic_cast<void*>(const_cast<std::remove_cv_t<T>*>(ptr));
+        } else {
+            memory = const_cast<std::remove_cv_t<T>*>(ptr);
+        }
+        ptr->~T();
+        BlockPool::Deallocate(memory, sizeof(T));
+    }
+};
+
+// Pooled arrays keep their length in a header in front of the elements.
+template <typename T>
+struct PoolDeleter<T[]> {
+    static constexpr size_t kHeaderSize = BlockPool::kAlignment;
+
+    PoolDeleter() {
+    }
+
+    static size_t AllocationSize(size_t count) {
+        return kHeaderSize + count * sizeof(T);
+    }
+
+    void operator()(T* ptr) const {
+        char* memory = reinterpret_cast<char*>(ptr) - kHeaderSize;
+        size_t count = *reinterpret_cast<size_t*>(memory);
+        for (size_t i = count; i > 0; --i) {
+            std::destroy_at(ptr + i - 1);
+        }
+        BlockPool::Deallocate(memory, AllocationSize(count));
+    }
+};
+
+template <typename T>
+using PooledUniquePtr = UniquePtr<T, PoolDeleter<T>>;
+
+namespace details {
+    template <typename T, typename... Args>
+    T* PoolNew(Args&&... args) {
+        static_assert(alignof(T) <= BlockPool::kAlignment);
+        void* memory = BlockPool::Allocate(sizeof(T));
+        try {
+            return ::new (memory) T(std::forward<Args>(args)...);
+        } catch (...) {
+            BlockPool::Deallocate(memory, sizeof(T));
+            throw;
+        }
+    }
+
+    template <typename T>
+    T* PoolNewForOverwrite() {
+        static_assert(alignof(T) <= BlockPool::kAlignment);
+        void* memory = BlockPool::Allocate(sizeof(T));
+        try {
+            return ::new (memory) T;
+        } catch (...) {
+            BlockPool::Deallocate(memory, sizeof(T));
+            throw;
+        }
+    }
+
+    template <typename T>
+    T* PoolNewArray(size_t count, bool value_init) {
+        static_assert(alignof(T) <= BlockPool::kAlignment);
+        if (count > (SIZE_MAX - PoolDeleter<T[]>::kHeaderSize) / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        size_t size = PoolDeleter<T[]>::AllocationSize(count);
+        char* memory = static_cast<char*>(BlockPool::Allocate(size));
+        *reinterpret_cast<size_t*>(memory) = count;
+        T* elements = reinterpret_cast<T*>(memory + PoolDeleter<T[]>::kHeaderSize);
+        size_t constructed = 0;
+        try {
+            for (; constructed < count; ++constructed) {
+                if (value_init) {
+                    ::new (elements + constructed) T();
+                } else {
+                    ::new (elements + constructed) T;
+                }
+            }
+        } catch (...) {
+            while (constructed > 0) {
+                std::destroy_at(elements + --constructed);
+            }
+            BlockPool::Deallocate(memory, size);
+            throw;
+        }
+        return elements;
+    }
+}  // namespace details
+
+// Pooled counterparts of new T(args...) and new T[count]. MakeUnique
+// value-initialises array elements; the ForOverwrite variants
+// default-initialise, so trivial types are left unwritten.
+
+template <typename T, typename... Args>
+std::enable_if_t<!std::is_array_v<T>, PooledUniquePtr<T>> MakeUnique(Args&&... args) {
+    return PooledUniquePtr<T>(details::PoolNew<T>(std::forward<Args>(args)...));
+}
+
+template <typename T>
+std::enable_if_t<std::is_array_v<T> && std::extent_v<T> == 0, PooledUniquePtr<T>> MakeUnique(size_t count) {
+    return PooledUniquePtr<T>(details::PoolNewArray<std::remove_extent_t<T>>(count, true));
+}
+
+template <typename T>
+std::enable_if_t<!std::is_array_v<T>, PooledUniquePtr<T>> MakeUniqueForOverwrite() {
+    return PooledUniquePtr<T>(details::PoolNewForOverwrite<T>());
+}
+
+template <typename T>
+std::enable_if_t<std::is_array_v<T> && std::extent_v<T> == 0, PooledUniquePtr<T>> MakeUniqueForOverwrite(
+    size_t count) {
+    return PooledUniquePtr<T>(details::PoolNewArray<std::remove_extent_t<T>>(count, false));
+}
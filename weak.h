@@ -2,27 +2,41 @@
 
 #include "sw_fwd.h"  // Forward declaration
 
+#include <functional>
 
-template <typename T>
+
+template <typename T, typename Policy>
 class WeakPtr {
 public:
-    template <typename U>
+    template <typename U, typename P>
     friend class SharedPtr;
-    template <typename U>
+    template <typename U, typename P>
     friend class WeakPtr;
 
-    template <typename U>
+    template <typename U, typename P>
     friend class ControlBlockDirect;
-    template <typename U>
+    template <typename U, typename P, typename D>
     friend class ControlBlockIndirect;
+    template <typename U, typename D, typename A, typename P>
+    friend class ControlBlockIndirectAlloc;
+    template <typename U, typename A, typename P>
+    friend class ControlBlockDirectAlloc;
+    template <typename U, typename P>
+    friend class ControlBlockDeferred;
+    template <typename U, typename H, typename P>
+    friend class ControlBlockExpiry;
 
 public:
+    // Holds only raw pointers, so containers may move it with memcpy.
+    using TriviallyRelocatable = std::true_type;
 
-    WeakPtr() {
+public:
+
+    WeakPtr() noexcept {
     }
 
     template <typename U>
-    WeakPtr(const WeakPtr<U>& other) {
+    WeakPtr(const WeakPtr<U, Policy>& other) {
         control_block_ = other.control_block_;
         ptr_ = other.ptr_;
         if (control_block_) {
@@ -39,7 +53,7 @@ public:
     }
 
     template <typename U>
-    WeakPtr(WeakPtr<U>&& other) {
+    WeakPtr(WeakPtr<U, Policy>&& other) noexcept {
         control_block_ = other.control_block_;
         ptr_ = other.ptr_;
 
@@ -47,7 +61,7 @@ public:
         other.ptr_ = nullptr;
     }
 
-    WeakPtr(WeakPtr&& other) {
+    WeakPtr(WeakPtr&& other) noexcept {
         control_block_ = other.control_block_;
         ptr_ = other.ptr_;
 
@@ -56,7 +70,7 @@ public:
     }
 
     template <typename U>
-    WeakPtr(const SharedPtr<U>& other) {
+    WeakPtr(const SharedPtr<U, Policy>& other) {
         control_block_ = other.control_block_;
         ptr_ = other.ptr_;
 
@@ -65,7 +79,7 @@ public:
         }
     }
 
-    WeakPtr(const SharedPtr<T>& other) {
+    WeakPtr(const SharedPtr<T, Policy>& other) {
         control_block_ = other.control_block_;
         ptr_ = other.ptr_;
 
@@ -75,7 +89,7 @@ public:
     }
 
     template <typename U>
-    WeakPtr& operator=(const WeakPtr<U>& other) {
+    WeakPtr& operator=(const WeakPtr<U, Policy>& other) {
         DecRef();
         control_block_ = other.control_block_;
         ptr_ = other.ptr_;
@@ -100,7 +114,7 @@ public:
     }
 
     template <typename U>
-    WeakPtr& operator=(WeakPtr<U>&& other) {
+    WeakPtr& operator=(WeakPtr<U, Policy>&& other) noexcept {
         DecRef();
 
         control_block_ = other.control_block_;
@@ -111,7 +125,7 @@ public:
         return *this;
     }
 
-    WeakPtr& operator=(WeakPtr&& other) {
+    WeakPtr& operator=(WeakPtr&& other) noexcept {
         if (this != &other) {
             DecRef();
 
@@ -131,28 +145,34 @@ public:
     void Reset() {
         DecRef();
     }
-    void Swap(WeakPtr& other) {
+    void Swap(WeakPtr& other) noexcept {
         std::swap(control_block_, other.control_block_);
         std::swap(ptr_, other.ptr_);
     }
 
+    friend void swap(WeakPtr& left, WeakPtr& right) noexcept {
+        left.Swap(right);
+    }
+
     size_t UseCount() const {
         return control_block_ ? control_block_->RefCount() : 0;
     }
+    const void* OwnerId() const noexcept {
+        return control_block_;
+    }
     bool Expired() const {
         return UseCount() == 0;
     }
-    SharedPtr<T> Lock() const {
-        return Expired() ? SharedPtr<T>() : SharedPtr<T>(*this);
+    SharedPtr<T, Policy> Lock() const {
+        SharedPtr<T, Policy> result;
+        result.TryLock(*this);
+        return result;
     }
 
 private:
     void DecRef() {
         if (control_block_) {
             control_block_->DecRefWeak();
-            if (control_block_->TotalCount() == 0) {
-                delete control_block_;
-            }
             control_block_ = nullptr;
             ptr_ = nullptr;
         }
@@ -165,6 +185,23 @@ private:
     }
 
 private:
-    IControlBlock* control_block_ = nullptr;
-    T* ptr_ = nullptr;
+    IControlBlock<Policy>* control_block_ = nullptr;
+    std::remove_extent_t<T>* ptr_ = nullptr;
+};
+
+// Order and hash SharedPtrs and WeakPtrs by the block that owns them rather
+// than by the pointer they hold, so aliases of one object compare equal and a
+// WeakPtr keeps its position after the object expires.
+struct OwnerHash {
+    template <typename Ptr>
+    size_t operator()(const Ptr& ptr) const noexcept {
+        return std::hash<const void*>()(ptr.OwnerId());
+    }
+};
+
+struct OwnerLess {
+    template <typename Left, typename Right>
+    bool operator()(const Left& left, const Right& right) const noexcept {
+        return std::less<const void*>()(left.OwnerId(), right.OwnerId());
+    }
 };
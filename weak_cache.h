@@ -0,0 +1,132 @@
+#pragma once
+
+#include "shared.h"
+#include "weak.h"
+
+#include <atomic>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <unordered_map>
+
+// Interning cache that holds its values weakly: a value lives as long as some
+// caller holds a SharedPtr to it, and GetOrCreate hands out the live one if
+// there is one. Keys are spread over independently locked shards.
+//
+// Values are created with MakeSharedWithExpiry, whose hook counts expirations
+// per shard. A shard sweeps out its dead entries once at least half of them
+// have expired, so pruning costs amortised O(1) per value and lookups never
+// wait for a full rescan.
+template <typename K, typename T, typename Hash = std::hash<K>, typename Policy = AtomicPolicy>
+class WeakValueCache {
+public:
+    static constexpr size_t kShardCount = 16;
+
+    WeakValueCache() {
+    }
+
+    WeakValueCache(const WeakValueCache&) = delete;
+    WeakValueCache& operator=(const WeakValueCache&) = delete;
+
+    // Returns the live value for key, or constructs T(args...) and caches it.
+    // Construction runs under the shard lock, so a value is never built twice.
+    template <typename... Args>
+    SharedPtr<T, Policy> GetOrCreate(const K& key, Args&&... args) {
+        Shard& shard = ShardOf(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        SharedPtr<T, Policy> value;
+        auto it = shard.entries.find(key);
+        if (it != shard.entries.end() && value.TryLock(it->second)) {
+            return value;
+        }
+        // Built before the entry is touched, so a throwing constructor leaves
+        // the shard as it was.
+        value = MakeSharedWithExpiry<T, Policy>(ExpiryHook{shard.expired}, std::forward<Args>(args)...);
+        if (it != shard.entries.end()) {
+            it->second = value;
+        } else {
+            shard.entries.emplace(key, value);
+        }
+        shard.MaybePrune();
+        return value;
+    }
+
+    // Returns the live value for key, or null.
+    SharedPtr<T, Policy> Get(const K& key) {
+        Shard& shard = ShardOf(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        SharedPtr<T, Policy> value;
+        auto it = shard.entries.find(key);
+        if (it != shard.entries.end()) {
+            value.TryLock(it->second);
+        }
+        return value;
+    }
+
+    void Erase(const K& key) {
+        Shard& shard = ShardOf(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.entries.erase(key);
+    }
+
+    // Sweeps every shard now.
+    void Prune() {
+        for (Shard& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.Prune();
+        }
+    }
+
+    // Entries held, including expired ones not yet swept.
+    size_t Size() const {
+        size_t size = 0;
+        for (const Shard& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            size += shard.entries.size();
+        }
+        return size;
+    }
+
+private:
+    using Counter = SharedPtr<std::atomic<size_t>, AtomicPolicy>;
+
+    // Shares ownership of the counter, so values may outlive the cache.
+    struct ExpiryHook {
+        Counter expired;
+
+        void operator()() const {
+            expired->fetch_add(1, std::memory_order_relaxed);
+        }
+    };
+
+    struct alignas(64) Shard {
+        mutable std::mutex mutex;
+        std::unordered_map<K, WeakPtr<T, Policy>, Hash> entries;
+        Counter expired = MakeShared<std::atomic<size_t>, AtomicPolicy>(0);
+
+        void MaybePrune() {
+            if (2 * expired->load(std::memory_order_relaxed) >= entries.size()) {
+                Prune();
+            }
+        }
+
+        // Expirations that race with the sweep are counted towards the next
+        // one even if their entries went in this one; that only brings it
+        // forward.
+        void Prune() {
+            expired->store(0, std::memory_order_relaxed);
+            for (auto it = entries.begin(); it != entries.end();) {
+                it = it->second.Expired() ? entries.erase(it) : std::next(it);
+            }
+        }
+    };
+
+    Shard& ShardOf(const K& key) {
+        // Mix the hash so that keys with weak low bits still spread out.
+        size_t hash = Hash()(key) * 0x9E3779B97F4A7C15ULL;
+        return shards_[(hash >> 32) % kShardCount];
+    }
+
+private:
+    Shard shards_[kShardCount];
+};